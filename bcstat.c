@@ -0,0 +1,72 @@
+// Print buffer cache and disk statistics.
+//
+// usage: bcstat [seconds]
+// Without an argument, print the totals since boot.  With one,
+// print them, then what changed every so many seconds.
+
+#include "types.h"
+#include "stat.h"
+#include "bcstat.h"
+#include "user.h"
+
+struct bcstat prev, cur;
+
+// Print n/d as a percentage, or "-" if d is 0.
+void
+percent(uint n, uint d)
+{
+  if(d == 0)
+    printf(1, "-");
+  else
+    printf(1, "%d%%", n * 100 / d);
+}
+
+// Print the counts of cur minus those of last.
+void
+print(struct bcstat *last)
+{
+  uint hits, misses, raread, rahits, reads, writes, qsum, n;
+
+  hits = cur.hits - last->hits;
+  misses = cur.misses - last->misses;
+  raread = cur.raread - last->raread;
+  rahits = cur.rahits - last->rahits;
+  reads = cur.reads - last->reads;
+  writes = cur.writes - last->writes;
+  qsum = cur.qsum - last->qsum;
+  n = reads + writes;
+
+  printf(1, "cache: %d of %d bufs, %d hits, %d misses (", cur.nbuf,
+         cur.maxbuf, hits, misses);
+  percent(hits, hits + misses);
+  printf(1, " hit), %d evictions, %d waits\n",
+         cur.evictions - last->evictions, cur.waits - last->waits);
+  printf(1, "readahead: %d blocks, %d used (", raread, rahits);
+  percent(rahits, raread);
+  printf(1, ")\n");
+  printf(1, "disk: %d reads, %d writes, queue depth %d.%d avg\n",
+         reads, writes, n ? qsum / n : 0, n ? qsum * 10 / n % 10 : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int secs;
+
+  secs = 0;
+  if(argc > 1)
+    secs = atoi(argv[1]);
+  for(;;){
+    if(bcstat(&cur) < 0){
+      printf(2, "bcstat: bcstat failed\n");
+      exit();
+    }
+    print(&prev);
+    if(secs <= 0)
+      break;
+    prev = cur;
+    sleep(secs * 100);
+    printf(1, "\n");
+  }
+  exit();
+}
@@ -0,0 +1,17 @@
+// Buffer cache and disk statistics returned by the bcstat
+// system call.  Counts are totals since boot.
+
+struct bcstat {
+  uint nbuf;       // Buffers in the cache
+  uint maxbuf;     // Most buffers the cache grows to on a miss
+  uint hits;       // Lookups that found the block cached
+  uint misses;     // Lookups that did not
+  uint evictions;  // Cached blocks recycled for other blocks
+  uint waits;      // Hits on a buffer that another process held
+  uint raread;     // Blocks read ahead
+  uint rahits;     // Of those, blocks that were then read
+  uint reads;      // Disk reads
+  uint writes;     // Disk writes
+  uint qsum;       // Sum over disk requests of the queue length,
+                   // including themselves, when they joined it
+};
@@ -1,13 +1,24 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
-// in memory reduces the number of disk reads and also provides
-// a synchronization point for disk blocks used by multiple processes.
+// The buffer cache is a hash table of buf structures holding
+// cached copies of disk block contents, with a lock per bucket.
+// Caching disk blocks in memory reduces the number of disk reads
+// and also provides a synchronization point for disk blocks used
+// by multiple processes.
+//
+// Buffers come from a slab cache.  The cache starts with NBUF of
+// them and grows on a miss, up to 1/BCACHEFRAC of memory, before
+// it recycles old ones; bshrink() gives unused ones back when
+// memory runs short (see swapalloc in swap.c).  Unused buffers
+// are kept on a list in the order they were released, so that
+// both find the least recently used one at its head.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To overlap several disk operations, set B_DIRTY (to write)
+//     or leave B_VALID clear (to read), call bsubmit on each
+//     buffer, and then bwait or bwaitall.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -17,79 +28,256 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Lookups are counted per CPU, for the bcstat system call.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bcstat.h"
 
-struct {
+#define NBUCKET 1021  // hash buckets, by (dev, blockno)
+#define NSHRINK 64    // most buffers one bshrink() frees
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // list of the buffers in this bucket
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+// Counts of one CPU; only it updates them, with interrupts off.
+struct bcpu {
+  uint hits;
+  uint misses;
+  uint evictions;
+  uint waits;
+  uint raread;
+  uint rahits;
+};
+
+struct {
+  struct spinlock lock;  // serializes adding and removing buffers
+  struct kmem_cache *cache;
+  int nbuf;              // buffers in the cache
+  int maxbuf;            // grow no further than this on a miss
+  struct bucket bucket[NBUCKET];
+  // Buffers with refcnt 0 and B_DIRTY clear, least recently
+  // released first.  Linked through lprev/lnext.
+  struct spinlock lrulock;
+  struct buf lru;
+  struct bcpu cpu[NCPU];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % NBUCKET];
+}
+
+static void
+binsert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head;
+  b->prev = 0;
+  if(bk->head)
+    bk->head->prev = b;
+  bk->head = b;
+}
+
+static void
+bremove(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+// Put b at the tail of the LRU list.
+// Caller must hold the lock of b's bucket.
+static void
+lruappend(struct buf *b)
+{
+  acquire(&bcache.lrulock);
+  b->lprev = bcache.lru.lprev;
+  b->lnext = &bcache.lru;
+  bcache.lru.lprev->lnext = b;
+  bcache.lru.lprev = b;
+  release(&bcache.lrulock);
+}
+
+// Take b off the LRU list if it is on it.
+// Caller must hold the lock of b's bucket.
+static void
+lruremove(struct buf *b)
+{
+  acquire(&bcache.lrulock);
+  if(b->lnext){
+    b->lprev->lnext = b->lnext;
+    b->lnext->lprev = b->lprev;
+    b->lprev = b->lnext = 0;
+  }
+  release(&bcache.lrulock);
+}
+
+// Allocate a new buffer holding no block.
+// Caller must hold bcache.lock.
+static struct buf*
+balloc(void)
+{
+  struct buf *b;
+
+  if((b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  initsleeplock(&b->lock, "buffer");
+  b->lprev = b->lnext = 0;
+  bcache.nbuf++;
+  return b;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
+  bcache.maxbuf = phystop / BCACHEFRAC / sizeof(struct buf);
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  initlock(&bcache.lrulock, "bcache.lru");
+  bcache.lru.lprev = &bcache.lru;
+  bcache.lru.lnext = &bcache.lru;
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // The first buffers start out in bucket 0, holding no block.
+  for(i = 0; i < NBUF; i++){
+    if((b = balloc()) == 0)
+      panic("binit");
+    binsert(&bcache.bucket[0], b);
+    lruappend(b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block on device dev in bucket bk, whose lock
+// the caller holds, and take a reference to it.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      if(b->refcnt++ == 0)
+        lruremove(b);
+      bcache.cpu[cpuid()].hits++;
+      if(b->lock.locked)
+        bcache.cpu[cpuid()].waits++;
       return b;
     }
   }
+  return 0;
+}
+
+// Take the least recently released unused buffer out of
+// its bucket and the LRU list.  Returns 0 if there is none.
+// Caller must hold bcache.lock, which keeps every buffer in
+// its bucket, so that the bucket can be locked after the
+// LRU list; recheck once holding it, since a lookup may have
+// taken the buffer meanwhile.
+static struct buf*
+lrutake(void)
+{
+  struct bucket *bk;
+  struct buf *b;
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+  for(;;){
+    acquire(&bcache.lrulock);
+    b = bcache.lru.lnext;
+    release(&bcache.lrulock);
+    if(b == &bcache.lru)
+      return 0;
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && b->lnext){
+      lruremove(b);
+      bremove(bk, b);
+      release(&bk->lock);
       return b;
     }
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+//
+// A cache hit takes only the lock of the block's bucket.
+// A miss takes bcache.lock, so that only one CPU at a time
+// adds buffers or moves them between buckets.  It uses a
+// new buffer while the cache is below its maximum size, and
+// otherwise recycles the least recently released unused
+// buffer, from the head of the LRU list.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  acquire(&bcache.lock);
+  // Someone else may have read it in meanwhile.
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached; grow the cache if allowed and memory is not short.
+  bcache.cpu[cpuid()].misses++;
+  if(bcache.nbuf < bcache.maxbuf && !kmemlow(1) && (b = balloc()) != 0)
+    goto found;
+
+  // Recycle an unused buffer.
+  if((b = lrutake()) != 0)
+    bcache.cpu[cpuid()].evictions++;
+  else if((b = balloc()) == 0)
+    panic("bget: no buffers");  // all in use; past maxbuf if need be
+
+found:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  acquire(&bk->lock);
+  binsert(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -101,6 +289,11 @@ bread(uint dev, uint blockno)
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
+  } else if(b->flags & B_RA){
+    b->flags &= ~B_RA;
+    pushcli();
+    bcache.cpu[cpuid()].rahits++;
+    popcli();
   }
   return b;
 }
@@ -115,29 +308,145 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start the disk writing b, if B_DIRTY is set, or else
+// reading it, without waiting.  b must be locked, and its
+// data must not be used until bwait(b) returns.  Or set
+// b->iodone instead of waiting: the disk driver calls it,
+// possibly from an interrupt handler, when the I/O is done.
+void
+bsubmit(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bsubmit");
+  idesubmit(b);
+}
+
+// Wait for the I/O started by bsubmit(b) to finish.
+void
+bwait(struct buf *b)
+{
+  idewaitbuf(b);
+}
+
+// Wait for the I/O on the n buffers in bufs to finish.
+void
+bwaitall(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    idewaitbuf(bufs[i]);
+}
+
+static void biodone(struct buf*);
+
+// Start reading a block into the cache, unless it is there
+// already, without waiting for the disk.  The buffer stays
+// locked until the read finishes, so a bread() of it waits.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_RA;
+  b->iodone = biodone;
+  bsubmit(b);
+  pushcli();
+  bcache.cpu[cpuid()].raread++;
+  popcli();
+}
+
+// Drop a reference to b, whose sleep-lock the caller has
+// released.  If it is now unused, put it at the tail of the
+// LRU list.  Even if refcnt==0, B_DIRTY indicates a buffer is
+// in use because log.c has modified it but not yet installed
+// it; it joins the list when released after the install.
+// Only a holder of a buffer changes B_DIRTY.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+    // no one is waiting for it.
+    lruappend(b);
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  releasesleep(&b->lock);
+  bput(b);
+}
 
+// Completion for breadahead(): release b for the process
+// that started the read.
+static void
+biodone(struct buf *b)
+{
   releasesleep(&b->lock);
+  bput(b);
+}
+// Free up to NSHRINK of the least recently used unused
+// buffers, keeping at least NBUF, when memory runs short.
+// Returns the number of buffers freed.
+int
+bshrink(void)
+{
+  struct buf *b;
+  int n;
 
   acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(n = 0; n < NSHRINK && bcache.nbuf > NBUF; n++){
+    if((b = lrutake()) == 0)
+      break;
+    kmem_cache_free(bcache.cache, b);
+    bcache.nbuf--;
   }
-  
   release(&bcache.lock);
+  return n;
+}
+
+// Fill in the cache counts of st.
+void
+bstat(struct bcstat *st)
+{
+  struct bcpu *c;
+
+  memset(st, 0, sizeof(*st));
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
+  for(c = bcache.cpu; c < &bcache.cpu[ncpu]; c++){
+    st->hits += c->hits;
+    st->misses += c->misses;
+    st->evictions += c->evictions;
+    st->waits += c->waits;
+    st->raread += c->raread;
+    st->rahits += c->rahits;
+  }
 }
 //PAGEBREAK!
 // Blank page.
@@ -4,11 +4,15 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *lprev; // LRU list of unused buffers
+  struct buf *lnext; // (0 if not on it)
   struct buf *qnext; // disk queue
+  void (*iodone)(struct buf*); // if set, called when I/O is done
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_RA    0x8  // read ahead, not read by anyone yet
 
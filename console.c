@@ -191,7 +191,7 @@ struct {
 void
 consoleintr(int (*getc)(void))
 {
-  int c, doprocdump = 0;
+  int c, doprocdump = 0, dokmemdump = 0;
 
   acquire(&cons.lock);
   while((c = getc()) >= 0){
@@ -200,6 +200,9 @@ consoleintr(int (*getc)(void))
       // procdump() locks cons.lock indirectly; invoke later
       doprocdump = 1;
       break;
+    case C('F'):  // Free memory listing.
+      dokmemdump = 1;
+      break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
             input.buf[(input.e-1) % INPUT_BUF] != '\n'){
@@ -230,10 +233,14 @@ consoleintr(int (*getc)(void))
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
   }
+  if(dokmemdump){
+    kmemdump();
+    slabdump();
+  }
 }
 
 int
-consoleread(struct inode *ip, char *dst, int n)
+consoleread(struct inode *ip, int user_dst, char *dst, int n)
 {
   uint target;
   int c;
@@ -259,7 +266,8 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    if(either_copyout(user_dst, dst++, &c, 1) < 0)
+      break;
     --n;
     if(c == '\n')
       break;
@@ -271,14 +279,18 @@ consoleread(struct inode *ip, char *dst, int n)
 }
 
 int
-consolewrite(struct inode *ip, char *buf, int n)
+consolewrite(struct inode *ip, int user_src, char *buf, int n)
 {
+  char c;
   int i;
 
   iunlock(ip);
   acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
+  for(i = 0; i < n; i++){
+    if(either_copyin(&c, user_src, buf + i, 1) < 0)
+      break;
+    consputc(c & 0xff);
+  }
   release(&cons.lock);
   ilock(ip);
 
@@ -2,6 +2,10 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct meminfo;
+struct bcstat;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -12,9 +16,15 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+int             bshrink(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bsubmit(struct buf*);
+void            bwait(struct buf*);
+void            bwaitall(struct buf**, int);
+void            breadahead(uint, uint);
+void            bstat(struct bcstat*);
 
 // console.c
 void            consoleinit(void);
@@ -31,7 +41,7 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
-int             filestat(struct file*, struct stat*);
+int             filestat(struct file*, char*);
 int             filewrite(struct file*, char*, int n);
 
 // fs.c
@@ -40,6 +50,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -49,14 +60,18 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
-int             readi(struct inode*, char*, uint, uint);
+int             readi(struct inode*, int, char*, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
-int             writei(struct inode*, char*, uint, uint);
+int             writei(struct inode*, int, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            idewaitbuf(struct buf*);
+void            idestat(struct bcstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,9 +80,20 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
+char*           kallocpages(int);
 void            kfree(char*);
+void            kfreepages(char*, int);
+char*           kdup(char*);
+int             krefcnt(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemdump(void);
+int             kmemlow(int);
+void            kmemstat(struct meminfo*);
+void            kzerod(void);
+int             kzerowanted(void);
+extern uint     phystop;
 
 // kbd.c
 void            kbdintr(void);
@@ -91,11 +117,34 @@ void            end_op();
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+int             pcifind(uint, uint, struct pcidev*);
+void            pcienable(struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+int             shmat(int);
+int             shmdt(uint);
+int             shmfork(struct proc*, struct proc*);
+void            shmexit(struct proc*);
+void            shmorphan(struct proc*);
+uint            shmend(uint);
+
+// pcache.c
+char*           pcacheget(struct inode*, uint, uint);
+void            pcacheinit(void);
+void            pcacheinval(struct inode*);
+int             pcacheshrink(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -107,6 +156,11 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             growhuge(int);
+int             either_copyin(void*, int, char*, uint);
+int             either_copyout(int, char*, void*, uint);
+void            idlewait(void);
+void            kthread(char*, void (*)(void));
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -124,6 +178,9 @@ int	            getpname(int);
 int	            getnice(int);
 int	            setnice(int, int);
 void	        ps(int);
+char*           swapvictim(uint);
+void            procmemstat(struct meminfo*);
+int             oomkill(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -137,6 +194,13 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabdump(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -152,9 +216,18 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+char*           swapalloc(void);
+char*           swapallocpages(int);
+void            swapfree(int);
+void            swapinit(int);
+void            swapread(int, char*);
+void            swapstat(struct meminfo*);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptrw(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -174,21 +247,35 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+int             virtioinit(void);
+void            virtiointr(void);
+int             virtiosubmit(struct buf*);
+void            virtiowaitbuf(struct buf*);
+extern int      virtioirq;
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
-char*           uva2ka(pde_t*, char*);
+int             uwritable(pde_t*, uint, uint);
 int             allocuvm(pde_t*, uint, uint);
+int             allochugeuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
-void            clearpteu(pde_t *pgdir, char *uva);
+int             copyin(pde_t*, void*, uint, uint);
+int             shareuvm(pde_t*, uint, char**, int);
+int             swapinuvm(pde_t*, uint, uint);
+int             mapfileuvm(pde_t*, uint, char*, struct inode*, uint, uint, uint);
+void            countuvm(pde_t*, uint*, uint*);
+char*           evictuvm(pde_t*, uint, uint*, uint);
+int             growstack(pde_t*, uint*, uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
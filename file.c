@@ -4,6 +4,7 @@
 
 #include "types.h"
 #include "defs.h"
+#include "stat.h"
 #include "param.h"
 #include "fs.h"
 #include "spinlock.h"
@@ -11,15 +12,20 @@
 #include "file.h"
 
 struct devsw devsw[NDEV];
+
+// File structures come from a slab cache (see slab.c),
+// so the number of open files is limited only by memory.
+// ftable.lock protects the reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +34,10 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +69,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -81,21 +82,51 @@ fileclose(struct file *f)
 
 // Get metadata about file f.
 int
-filestat(struct file *f, struct stat *st)
+filestat(struct file *f, char *addr)
 {
+  struct stat st;
+
   if(f->type == FD_INODE){
     ilock(f->ip);
-    stati(f->ip, st);
+    stati(f->ip, &st);
     iunlock(f->ip);
-    return 0;
+    return either_copyout(1, addr, &st, sizeof(st));
   }
   return -1;
 }
 
-// Read from file f.
+#define RAMIN  1   // first read-ahead window, in blocks
+#define RAMAX  8   // largest read-ahead window
+
+// Called after a read of f that started at off.  While reads
+// are sequential, keep the next f->ra blocks being read in,
+// doubling the window each time up to RAMAX; any other
+// access closes it.  Caller must hold f->ip->lock.
+static void
+readahead(struct file *f, uint off)
+{
+  uint start;
+
+  if(off != f->lastoff)
+    f->ra = f->raend = 0;
+  else if(f->ra == 0)
+    f->ra = RAMIN;
+  else if(f->ra < RAMAX)
+    f->ra *= 2;
+  f->lastoff = f->off;
+  if(f->ra == 0)
+    return;
+  start = f->raend > f->off ? f->raend : f->off;
+  f->raend = f->off + f->ra*BSIZE;
+  if(start < f->raend)
+    ireadahead(f->ip, start, f->raend - start);
+}
+
+// Read from file f into user address addr.
 int
 fileread(struct file *f, char *addr, int n)
 {
+  uint off;
   int r;
 
   if(f->readable == 0)
@@ -104,8 +135,10 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    off = f->off;
+    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    readahead(f, off);
     iunlock(f->ip);
     return r;
   }
@@ -113,7 +146,7 @@ fileread(struct file *f, char *addr, int n)
 }
 
 //PAGEBREAK!
-// Write to file f.
+// Write to file f from user address addr.
 int
 filewrite(struct file *f, char *addr, int n)
 {
@@ -130,7 +163,7 @@ filewrite(struct file *f, char *addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -139,18 +172,18 @@ filewrite(struct file *f, char *addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
 
       if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
+        break;  // error from writei
       i += r;
+      if(r != n1)
+        break;  // bad user address: short write
     }
-    return i == n ? n : -1;
+    return i > 0 || n == 0 ? i : -1;
   }
   panic("filewrite");
 }
@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint lastoff;  // where the last read ended
+  uint ra;       // read-ahead window, in blocks
+  uint raend;    // read-ahead started up to here
 };
 
 
@@ -14,6 +17,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // icache list
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,9 +31,10 @@ struct inode {
 
 // table mapping major device number to
 // device functions
+// (The int says whether the char* is a user address.)
 struct devsw {
-  int (*read)(struct inode*, char*, int);
-  int (*write)(struct inode*, char*, int);
+  int (*read)(struct inode*, int, char*, int);
+  int (*write)(struct inode*, int, char*, int);
 };
 
 extern struct devsw devsw[];
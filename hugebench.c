@@ -0,0 +1,59 @@
+// Compare touching a large heap mapped with 4 KB pages
+// (sbrk) and with 4 MB pages (sbrkhuge).
+//
+// usage: hugebench [megabytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PASSES 64
+#define STRIDE 4096
+
+int
+touch(char *p, int total)
+{
+  int i, pass, start;
+
+  start = uptime();
+  for(pass = 0; pass < PASSES; pass++)
+    for(i = 0; i < total; i += STRIDE)
+      p[i]++;
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p;
+  int mb, total, t;
+
+  mb = 16;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  total = mb * 1024 * 1024;
+
+  if((p = sbrk(total)) == (char*)-1){
+    printf(2, "hugebench: sbrk failed\n");
+    exit();
+  }
+  t = touch(p, total);
+  printf(1, "4KB pages: %d MB x %d in %d ticks\n", mb, PASSES, t);
+  sbrk(-total);
+
+  if((p = sbrkhuge(total)) == (char*)-1){
+    printf(2, "hugebench: sbrkhuge failed\n");
+    exit();
+  }
+  t = touch(p, total);
+  printf(1, "4MB pages: %d MB x %d in %d ticks\n", mb, PASSES, t);
+
+  // fork() must copy the 4 MB pages.
+  if(fork() == 0){
+    if(p[0] != PASSES || p[total - STRIDE] != PASSES)
+      printf(2, "hugebench: bad copy in child\n");
+    exit();
+  }
+  wait();
+  exit();
+}
@@ -1,4 +1,7 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses PCI bus-master DMA when the
+// controller supports it (QEMU's PIIX does), and PIO otherwise.
+// If there is a virtio block device, it is disk 1 instead of
+// the IDE disk, and requests for it go to virtio.c.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +15,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "bcstat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,17 +28,58 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+#define IDE_MAXMUL    16  // most sectors per READ/WRITE MULTIPLE
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// The first idenbuf bufs of the queue are for consecutive blocks
+// and are being transferred by one command.  The rest are kept
+// in C-LOOK order: blocks at or after the active one, ascending,
+// then the blocks before it, ascending, so that the disk sweeps
+// in one direction and runs of blocks end up next to each other.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenbuf;
+static int idelen;      // bufs in idequeue
+
+// Requests to both disks, for bcstat.  Protected by idelock.
+static struct {
+  uint reads;
+  uint writes;
+  uint qsum;
+} iostat;
 
 static int havedisk1;
+static int virtiodisk1;
 static void idestart(struct buf*);
 
+// Bus-master DMA registers, at idebm (0 if there is no DMA).
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_START      0x01  // in BM_CMD
+#define BM_READ       0x08  // in BM_CMD: DMA to memory
+#define BM_ERR        0x02  // in BM_STATUS
+#define BM_INTR       0x04  // in BM_STATUS
+
+// Physical region descriptor: one buf's data.  The table
+// must not cross a 64 KB boundary, nor may a region.
+struct prd {
+  uint addr;
+  ushort n;       // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry in table
+
+static uint idebm;
+static struct prd prdt[IDE_MAXMUL] __attribute__((aligned(sizeof(struct prd)*IDE_MAXMUL)));
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -47,9 +93,22 @@ idewait(int checkerr)
   return 0;
 }
 
+// Set the number of sectors per interrupt for READ/WRITE
+// MULTIPLE on drive.
+static void
+idesetmul(int drive)
+{
+  idewait(0);
+  outb(0x1f2, IDE_MAXMUL);
+  outb(0x1f6, 0xe0 | (drive<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
 void
 ideinit(void)
 {
+  struct pcidev d;
   int i;
 
   initlock(&idelock, "ide");
@@ -65,37 +124,84 @@ ideinit(void)
     }
   }
 
+  // Let READ/WRITE MULTIPLE move IDE_MAXMUL sectors
+  // per interrupt.
+  idesetmul(0);
+  if(havedisk1)
+    idesetmul(1);
+
+  // Use DMA if the controller can do it.  bufs come from
+  // slabs aligned to their size, so no buf's data crosses
+  // a 64 KB boundary.
+  if(pcifind(0, PCI_CLASS_IDE, &d) == 0 && (d.bar[4] & 1)){
+    pcienable(&d);
+    idebm = d.bar[4] & ~3;
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  if(virtioinit() == 0)
+    virtiodisk1 = 1;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b, the head of idequeue, together
+// with the requests queued right behind it for the following
+// blocks in the same direction, up to IDE_MAXMUL sectors.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *q;
+  int i, n;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= FSSIZE + SWAPSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int write = b->flags & B_DIRTY;
 
-  if (sector_per_block > 7) panic("idestart");
+  // A block must fit in one READ/WRITE MULTIPLE interrupt.
+  if (sector_per_block > IDE_MAXMUL) panic("idestart");
+
+  n = 1;
+  for(q = b->qnext; q && (n+1)*sector_per_block <= IDE_MAXMUL; q = q->qnext){
+    if(q->dev != b->dev || q->blockno != b->blockno + n ||
+       (q->flags & B_DIRTY) != write)
+      break;
+    n++;
+  }
+  idenbuf = n;
+
+  if(idebm){
+    for(i = 0, q = b; i < n; i++, q = q->qnext){
+      prdt[i].addr = V2P(q->data);
+      prdt[i].n = BSIZE;
+      prdt[i].flags = i == n-1 ? PRD_EOT : 0;
+    }
+    outl(idebm + BM_PRDT, V2P(prdt));
+    outb(idebm + BM_CMD, write ? 0 : BM_READ);
+    outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_ERR | BM_INTR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n*sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, (write ? 0 : BM_READ) | BM_START);
+  } else if(write){
+    outb(0x1f7, n*sector_per_block == 1 ? IDE_CMD_WRITE : IDE_CMD_WRMUL);
+    for(i = 0, q = b; i < n; i++, q = q->qnext)
+      outsl(0x1f0, q->data, BSIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, n*sector_per_block == 1 ? IDE_CMD_READ : IDE_CMD_RDMUL);
   }
 }
 
@@ -103,66 +209,154 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *dbuf[IDE_MAXMUL];
+  void (*done[IDE_MAXMUL])(struct buf*);
+  int i, n, pio;
 
-  // First queued buffer is the active request.
+  // First idenbuf queued buffers are the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(idequeue == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // Stop the DMA engine; the data is already in the bufs.
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_ERR | BM_INTR);
+    idewait(0);
+    pio = 0;
+  } else {
+    // Read data if needed.
+    pio = !(idequeue->flags & B_DIRTY) && idewait(1) >= 0;
+  }
+  n = 0;
+  for(i = 0; i < idenbuf; i++){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(pio)
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.  Take the completion
+    // first: once the buf is valid, its owner may reuse it.
+    if(b->iodone){
+      dbuf[n] = b;
+      done[n++] = b->iodone;
+      b->iodone = 0;
+    }
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+  }
+  idelen -= idenbuf;
+  idenbuf = 0;
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
+
+  // Run the completions without idelock, so that they may
+  // take other locks.
+  for(i = 0; i < n; i++)
+    done[i](dbuf[i]);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Add b to idequeue in C-LOOK order, starting the disk if it
+// is idle.  Caller must hold idelock.
+// Returns the number of bufs now queued.
+static int
+ideappend(struct buf *b)
 {
   struct buf **pp;
+  uint pos;
+  int i;
 
   if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
+    panic("idesubmit: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+    panic("idesubmit: nothing to do");
   if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+    panic("idesubmit: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
+  if(idequeue == 0){
+    b->qnext = 0;
+    idequeue = b;
+    idelen = 1;
+    idestart(b);
+    return idelen;
+  }
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  // Distance from the active block in the sweep direction,
+  // wrapping around (unsigned) for blocks before it.
+  pos = idequeue->blockno;
+  pp = &idequeue;
+  for(i = 0; i < idenbuf; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp && (*pp)->blockno - pos <= b->blockno - pos; pp = &(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
+  return ++idelen;
+}
 
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  idewaitbuf(b);
+}
+
+// Queue b for the disk and return without waiting.
+void
+idesubmit(struct buf *b)
+{
+  int write, n;
 
-  // Wait for request to finish.
+  write = b->flags & B_DIRTY;
+  if(b->dev == 1 && virtiodisk1){
+    n = virtiosubmit(b);
+    acquire(&idelock);
+  } else {
+    acquire(&idelock);  //DOC:acquire-lock
+    n = ideappend(b);
+  }
+  if(write)
+    iostat.writes++;
+  else
+    iostat.reads++;
+  iostat.qsum += n;
+  release(&idelock);
+}
+
+// Wait for the request for b to finish.
+void
+idewaitbuf(struct buf *b)
+{
+  if(b->dev == 1 && virtiodisk1){
+    virtiowaitbuf(b);
+    return;
+  }
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
+  release(&idelock);
+}
 
-
+// Fill in the disk counts of st.
+void
+idestat(struct bcstat *st)
+{
+  acquire(&idelock);
+  st->reads = iostat.reads;
+  st->writes = iostat.writes;
+  st->qsum = iostat.qsum;
   release(&idelock);
 }
@@ -1,45 +1,175 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and
+// physically contiguous blocks of 2^order pages.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+uint phystop;  // top of physical memory, set by kinit1()
+
+// An entry of the BIOS memory map that bootasm.S leaves
+// at E820MAP.
+struct e820 {
+  uint addr;
+  uint addrhi;
+  uint len;
+  uint lenhi;
+  uint type;
+};
+#define E820_RAM 1  // usable memory
+
 struct run {
   struct run *next;
+  struct run *prev;
+};
+
+// Free memory is kept by a buddy allocator: a block of
+// 2^order pages starts at a page number that is a multiple
+// of 2^order, and its buddy is the block whose page number
+// differs only in bit order.  kmem.free[order] lists the
+// free blocks of each order, and kmem.blk[pn] is order+1
+// if page pn heads a free block (0 otherwise), so that
+// freeing a block can find and merge with its free buddy.
+//
+// Each CPU keeps a small cache of free pages so that most
+// kalloc()/kfree() calls touch only CPU-local state.  Pages
+// move between a CPU's cache and the buddy allocator
+// KBATCH at a time: a CPU refills when its cache is empty
+// and drains when it holds more than KCACHE pages.  When
+// the buddy allocator runs dry, every CPU's cache is drained
+// into it before an allocation fails (see kdrainall), so the
+// caches never strand memory; that is what kcpu.lock is for.
+//
+// kalloc_zeroed() hands out pages from a pool of pages that
+// the kzerod kernel thread clears while CPUs are idle, so
+// callers that need zeroed memory don't pay for the memset.
+#define KCACHE  64   // max pages cached per CPU
+#define KBATCH  16   // pages moved per refill / drain
+#define KZERO   256  // size of the pre-zeroed page pool
+#define KLOW    64   // low watermark, see kmemlow()
+
+struct kcpu {
+  struct spinlock lock;  // taken before kmem.lock
+  struct run *freelist;
+  int nfree;         // pages on freelist
+  uint hit;          // kalloc()s served from freelist
+  uint miss;         // kalloc()s that had to refill
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];  // free blocks of each order
+  int nblk[MAXORDER+1];         // number of blocks on free[order]
+  int nfree;                    // pages held by the buddy allocator
+  int npages;                   // pages given to the allocator
+  uint nfail;                   // failed allocations
+  int minfree;                  // fewest free pages buddyalloc() saw
+  struct kcpu cpu[NCPU];
+  struct spinlock zlock;
+  struct run *zero;             // pre-zeroed pages, ref 1
+  int nzero;                    // pages on zero
+  uint npn;                     // page frames below phystop
+  uchar *blk;                   // order+1 of free block at page
+  ushort *ref;                  // references to each physical page
+  struct e820 *map;             // BIOS memory map
+  struct e820 *emap;            // end of map
 } kmem;
 
+// Return the end of memory map entry e, clipped to what
+// the kernel can map.
+static uint
+e820end(struct e820 *e)
+{
+  if(e->lenhi || e->len > MAXPHYS - e->addr)
+    return MAXPHYS;
+  return e->addr + e->len;
+}
+
+// Find the top of usable memory from the BIOS memory map.
+// Memory at or above MAXPHYS has no kernel virtual address
+// and is left unused.
+static uint
+memdetect(void)
+{
+  struct e820 *e;
+  uint top;
+
+  kmem.map = (struct e820*)P2V(E820MAP+4);
+  kmem.emap = (struct e820*)P2V((uint)*(ushort*)P2V(E820MAP));
+  top = 0;
+  for(e = kmem.map; e < kmem.emap; e++)
+    if(e->type == E820_RAM && e->addrhi == 0 && e->addr < MAXPHYS &&
+       e820end(e) > top)
+      top = e820end(e);
+  if(top == 0){
+    // No map: assume the traditional fixed size.
+    kmem.emap = kmem.map;
+    top = PHYSTOP;
+  }
+  return PGROUNDDOWN(top);
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
-// the pages mapped by entrypgdir on free list.
+// the pages mapped by entrypgdir on free list.  The per-page
+// arrays, sized by the memory found, are carved off the front.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&kmem.zlock, "kzero");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kcpu");
   kmem.use_lock = 0;
+  for(i = 0; i <= MAXORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
+
+  phystop = memdetect();
+  kmem.npn = phystop / PGSIZE;
+  kmem.ref = (ushort*)vstart;
+  kmem.blk = (uchar*)(kmem.ref + kmem.npn);
+  vstart = kmem.blk + kmem.npn;
+  if(vstart > vend)
+    panic("kinit1");
+  memset(kmem.ref, 0, (char*)vstart - (char*)kmem.ref);
   freerange(vstart, vend);
 }
 
+// Free the usable parts of vstart..vend according to the
+// BIOS memory map, skipping the holes in it.
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  struct e820 *e;
+  uint s, t;
+
+  if(kmem.map == kmem.emap)
+    freerange(vstart, vend);
+  for(e = kmem.map; e < kmem.emap; e++){
+    if(e->type != E820_RAM || e->addrhi || e->addr >= MAXPHYS)
+      continue;
+    s = e->addr > V2P(vstart) ? e->addr : V2P(vstart);
+    t = e820end(e) < V2P(vend) ? e820end(e) : V2P(vend);
+    if(s < t)
+      freerange(P2V(s), P2V(t));
+  }
+  kmem.minfree = kmem.npages;
   kmem.use_lock = 1;
 }
 
@@ -48,32 +178,214 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p)/PGSIZE] = 1;
+    kmem.npages++;
     kfree(p);
+  }
+}
+
+// Pages free anywhere: in the buddy allocator, the CPU
+// caches and the zeroed pool.  Reads the counts without
+// their locks, so the answer is approximate.
+static int
+kfreecount(void)
+{
+  int i, n;
+
+  n = kmem.nfree + kmem.nzero;
+  for(i = 0; i < ncpu; i++)
+    n += kmem.cpu[i].nfree;
+  return n;
+}
+
+// Buddy allocator internals.  Caller must hold kmem.lock
+// (or be running before kinit2(), on one CPU).
+
+static void
+blkinsert(uint pn, int order)
+{
+  struct run *r, *h;
+
+  r = (struct run*)P2V(pn*PGSIZE);
+  h = &kmem.free[order];
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kmem.blk[pn] = order+1;
+  kmem.nblk[order]++;
+}
+
+static void
+blkremove(uint pn, int order)
+{
+  struct run *r;
+
+  r = (struct run*)P2V(pn*PGSIZE);
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.blk[pn] = 0;
+  kmem.nblk[order]--;
 }
+
+// Free the 2^order pages starting at page pn,
+// merging with free buddies as far as possible.
+static void
+buddyfree(uint pn, int order)
+{
+  uint bn;
+
+  kmem.nfree += 1 << order;
+  for(; order < MAXORDER; order++){
+    bn = pn ^ (1 << order);
+    if(bn >= kmem.npn || kmem.blk[bn] != order+1)
+      break;
+    blkremove(bn, order);
+    pn &= ~(1 << order);
+  }
+  blkinsert(pn, order);
+}
+
+// Allocate 2^order contiguous pages, splitting a larger
+// block if necessary.  Returns the first page number, or
+// 0 (never a valid free page) if there is no such block.
+static uint
+buddyalloc(int order)
+{
+  int o, n;
+  uint pn;
+
+  for(o = order; o <= MAXORDER; o++)
+    if(kmem.free[o].next != &kmem.free[o])
+      break;
+  if(o > MAXORDER)
+    return 0;
+  pn = V2P(kmem.free[o].next) / PGSIZE;
+  blkremove(pn, o);
+  while(o > order){
+    o--;
+    blkinsert(pn + (1 << o), o);
+  }
+  kmem.nfree -= 1 << order;
+  // Track the low-water mark here rather than on every
+  // kalloc(): the CPU caches come through here KBATCH
+  // pages at a time, so it is close enough.
+  if((n = kfreecount()) < kmem.minfree)
+    kmem.minfree = n;
+  return pn;
+}
+
+// Move up to n pages from the buddy allocator to c.
+// Caller must hold kmem.lock.
+static void
+krefill(struct kcpu *c, int n)
+{
+  struct run *r;
+  uint pn;
+
+  while(n-- > 0 && (pn = buddyalloc(0)) != 0){
+    r = (struct run*)P2V(pn*PGSIZE);
+    r->next = c->freelist;
+    c->freelist = r;
+    c->nfree++;
+  }
+}
+
+// Move n pages from c back to the buddy allocator.
+// Caller must hold kmem.lock.
+static void
+kdrain(struct kcpu *c, int n)
+{
+  struct run *r;
+
+  while(n-- > 0 && (r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->nfree--;
+    buddyfree(V2P(r)/PGSIZE, 0);
+  }
+}
+
+// Give the pages cached by every CPU back to the buddy
+// allocator, where any CPU can allocate them and they can
+// merge into larger blocks.  Caller must hold no kmem locks.
+static void
+kdrainall(void)
+{
+  struct kcpu *c;
+
+  for(c = kmem.cpu; c < &kmem.cpu[ncpu]; c++){
+    acquire(&c->lock);
+    acquire(&kmem.lock);
+    kdrain(c, c->nfree);
+    release(&kmem.lock);
+    release(&c->lock);
+  }
+}
+
+// Take a page from the zeroed pool, or return 0 if it is
+// empty.  All of the page but r->next is zero.
+static struct run*
+kzeroget(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock)
+    return 0;
+  acquire(&kmem.zlock);
+  if((r = kmem.zero) != 0){
+    kmem.zero = r->next;
+    kmem.nzero--;
+  }
+  release(&kmem.zlock);
+  return r;
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page goes back on the free list when the last
+// reference is dropped.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcpu *c;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+  if(kmem.ref[V2P(v)/PGSIZE] < 1)
+    panic("kfree: ref");
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1) > 0)
+    return;
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
+
+  if(!kmem.use_lock){
+    buddyfree(V2P(v)/PGSIZE, 0);
+    return;
+  }
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  pushcli();
+  c = &kmem.cpu[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->nfree++;
+  if(c->nfree > KCACHE){
+    acquire(&kmem.lock);
+    kdrain(c, KBATCH);
     release(&kmem.lock);
+  }
+  release(&c->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +395,231 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcpu *c;
+  uint pn;
+
+  if(!kmem.use_lock){
+    if((pn = buddyalloc(0)) == 0){
+      kmem.nfail++;
+      return 0;
+    }
+    kmem.ref[pn] = 1;
+    return P2V(pn*PGSIZE);
+  }
+
+  pushcli();
+  c = &kmem.cpu[cpuid()];
+  acquire(&c->lock);
+  if(c->freelist)
+    c->hit++;
+  else {
+    c->miss++;
+    acquire(&kmem.lock);
+    krefill(c, KBATCH);
+    release(&kmem.lock);
+  }
+  if((r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->nfree--;
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  }
+  release(&c->lock);
+  popcli();
+  if(r == 0){
+    // Other CPUs' caches may still hold pages.
+    kdrainall();
+    acquire(&kmem.lock);
+    if((pn = buddyalloc(0)) != 0){
+      kmem.ref[pn] = 1;
+      r = (struct run*)P2V(pn*PGSIZE);
+    }
+    release(&kmem.lock);
+  }
+  if(r == 0)
+    r = kzeroget();  // last resort
+  if(r == 0)
+    __sync_fetch_and_add(&kmem.nfail, 1);
+  return (char*)r;
+}
+
+// Allocate one zeroed page.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  char *v;
+
+  if((v = (char*)kzeroget()) != 0){
+    ((struct run*)v)->next = 0;
+    return v;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Is the pool of zeroed pages below its target?  The
+// scheduler wakes kzerod in idle time only if so.
+int
+kzerowanted(void)
+{
+  return kmem.nzero < KZERO;
+}
+
+// Kernel thread that keeps the pool of zeroed pages
+// stocked, clearing up to KBATCH pages each time a CPU
+// has nothing else to do.
+void
+kzerod(void)
+{
+  struct run *r;
+  int i;
+
+  for(;;){
+    idlewait();
+    for(i = 0; i < KBATCH && kmem.nzero < KZERO; i++){
+      if((r = (struct run*)kalloc()) == 0)
+        break;
+      memset(r, 0, PGSIZE);
+      acquire(&kmem.zlock);
+      r->next = kmem.zero;
+      kmem.zero = r;
+      kmem.nzero++;
+      release(&kmem.zlock);
+    }
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size.  kallocpages(0) is the same as kalloc().
+// Returns 0 if no large enough block is free, even with
+// the pages of the CPU caches given back.
+char*
+kallocpages(int order)
+{
+  uint pn;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  pn = buddyalloc(order);
+  if(pn == 0 && kmem.use_lock){
+    // Cached single pages may be what splits the blocks.
+    release(&kmem.lock);
+    kdrainall();
+    acquire(&kmem.lock);
+    pn = buddyalloc(order);
+  }
+  if(pn)
+    kmem.ref[pn] = 1;
+  else
+    kmem.nfail++;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  return pn ? P2V(pn*PGSIZE) : 0;
+}
+
+// Free a block returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) >= phystop)
+    panic("kfreepages");
+  if(kmem.ref[V2P(v)/PGSIZE] != 1)
+    panic("kfreepages: ref");
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+
+#ifdef KJUNK
+  memset(v, 1, PGSIZE << order);
+#endif
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  buddyfree(V2P(v)/PGSIZE, order);
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
 }
 
+// Add a reference to the page pointed at by v, so that
+// it can be mapped in more than one page table.
+// Returns v to enable the mem = kdup(mem) idiom.
+char*
+kdup(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kdup");
+
+  if(__sync_fetch_and_add(&kmem.ref[V2P(v)/PGSIZE], 1) < 1)
+    panic("kdup: free page");
+  return v;
+}
+
+// Return the number of references to the page pointed at by v.
+int
+krefcnt(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Return whether allocating n more pages would take free
+// memory below the low watermark.  User memory is not
+// allocated below it (see swapalloc()), which keeps a
+// reserve for the kernel's own allocations: page tables,
+// kernel stacks, pipes.  Reads the counts without locks,
+// so the answer is approximate.
+int
+kmemlow(int n)
+{
+  return kfreecount() - n < KLOW;
+}
+
+// Fill in the page counts of mi.
+void
+kmemstat(struct meminfo *mi)
+{
+  int i;
+
+  mi->npages = kmem.npages;
+  mi->nfree = kmem.nfree;
+  for(i = 0; i < ncpu; i++)
+    mi->nfree += kmem.cpu[i].nfree;
+  mi->nzero = kmem.nzero;
+  mi->nfail = kmem.nfail;
+  mi->minfree = kmem.minfree;
+}
+
+// Print free page counts, fragmentation and per-CPU cache
+// statistics to the console.  Runs when user types ^F on
+// console.  No lock to avoid wedging a stuck machine further.
+//
+// For each order, "unusable" is the percentage of free
+// memory that sits in blocks too small to satisfy a
+// request of that order.
+void
+kmemdump(void)
+{
+  int i, o, nfree, small;
+
+  nfree = kmem.nfree;
+  for(i = 0; i < ncpu; i++)
+    nfree += kmem.cpu[i].nfree;
+  cprintf("free pages %d (buddy %d) zeroed %d\n", nfree, kmem.nfree,
+          kmem.nzero);
+  small = 0;
+  for(o = 0; o <= MAXORDER; o++){
+    cprintf("order %d: %d free, unusable %d%%\n", o, kmem.nblk[o],
+            kmem.nfree ? small * 100 / kmem.nfree : 0);
+    small += kmem.nblk[o] << o;
+  }
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu%d: cached %d hit %d miss %d\n", i, kmem.cpu[i].nfree,
+            kmem.cpu[i].hit, kmem.cpu[i].miss);
+}
@@ -28,6 +28,15 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Committing a transaction only appends its blocks to the log
+// and rewrites the header; the blocks stay pinned in the buffer
+// cache.  The logflush kernel thread installs the committed
+// blocks to their home locations, and empties the log, once it
+// is more than LOGFLUSH full or begin_op() runs out of space.
+// The log may then hold several transactions, and a block that
+// several of them wrote appears once for each; recovery
+// installs the last copy.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,13 +51,19 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int installing;  // logflush is emptying the log, please wait.
+  int flush;       // logflush should empty the log.
+  int ncommit;     // lh.block[0..ncommit-1] are committed.
   int dev;
   struct logheader lh;
 };
 struct log log;
 
+#define LOGFLUSH (LOGSIZE/2)  // committed blocks that start an install
+
 static void recover_from_log(void);
 static void commit();
+static void logflush(void);
 
 void
 initlog(int dev)
@@ -63,22 +78,52 @@ initlog(int dev)
   log.size = sb.nlog;
   log.dev = dev;
   recover_from_log();
+  kthread("logflush", logflush);
+}
+
+// Is log.lh.block[tail] written again later in the log?
+static int
+overwritten(int tail)
+{
+  int i;
+
+  for (i = tail+1; i < log.lh.n; i++)
+    if (log.lh.block[i] == log.lh.block[tail])
+      return 1;
+  return 0;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks to their home location, from the log
+// when recovering, else from the cache, which holds them
+// pinned.  Only the last copy of each block is written.
+// All the writes are queued before waiting for any.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
-  int tail;
+  struct buf *dbufs[LOGSIZE];
+  int tail, n;
 
+  if (recovering) {
+    for (tail = 0; tail < log.lh.n; tail++)
+      breadahead(log.dev, log.start+tail+1);
+  }
+  n = 0;
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+    if (overwritten(tail))
+      continue;
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+    if (recovering) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    dbuf->flags |= B_DIRTY;
+    bsubmit(dbuf);  // write dst to disk
+    dbufs[n++] = dbuf;
   }
+  bwaitall(dbufs, n);
+  for (tail = 0; tail < n; tail++)
+    brelse(dbufs[tail]);
 }
 
 // Read the log header from disk into the in-memory log header
@@ -116,21 +161,47 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
 
+// Kernel thread that installs committed blocks and empties
+// the log when asked to, between transactions.
+static void
+logflush(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(!log.flush || log.outstanding > 0 || log.committing)
+      sleep(&log, &log.lock);
+    log.flush = 0;
+    log.installing = 1;
+    release(&log.lock);
+
+    install_trans(0);
+    log.lh.n = 0;
+    write_head();    // Erase the transactions from the log
+
+    acquire(&log.lock);
+    log.ncommit = 0;
+    log.installing = 0;
+    wakeup(&log);
+  }
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.installing){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+      // this op might exhaust log space; wait for commit,
+      // and for logflush to empty the log.
+      log.flush = 1;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -168,42 +239,52 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.ncommit = log.lh.n;
+    if(log.ncommit > LOGFLUSH)
+      log.flush = 1;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the blocks modified by this transaction from cache
+// to the log, after the committed ones.
+// All the writes are queued before waiting for any.
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *tos[LOGSIZE];
+  int tail, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  n = 0;
+  for (tail = log.ncommit; tail < log.lh.n; tail++) {
     struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    to->flags |= B_DIRTY;
+    bsubmit(to);  // write the log
     brelse(from);
-    brelse(to);
+    tos[n++] = to;
   }
+  bwaitall(tos, n);
+  for (tail = 0; tail < n; tail++)
+    brelse(tos[tail]);
 }
 
+// The blocks stay pinned until logflush installs them.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  if (log.lh.n > log.ncommit) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will do the disk write, and logflush
+// the write to the block's home location.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -221,7 +302,9 @@ log_write(struct buf *b)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
+  // Absorb only into this transaction: the committed copies
+  // in the log must not change.
+  for (i = log.ncommit; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
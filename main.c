@@ -17,7 +17,7 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
-  kinit1(end, P2V(4*1024*1024)); // phys page allocator
+  kinit1(end, P2V(8*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
@@ -28,12 +28,18 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  slabinit();      // kernel object caches
   binit();         // buffer cache
   fileinit();      // file table
+  icacheinit();    // inode cache
+  pipeinit();      // pipe buffers
+  pcacheinit();    // shared program pages
+  shminit();       // shared memory segments
   ideinit();       // disk 
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(8*1024*1024), P2V(phystop)); // must come after startothers()
   userinit();      // first user process
+  kthread("kzerod", kzerod); // pre-zeroed page pool
   mpmain();        // finish this processor's setup
 }
 
@@ -101,10 +107,13 @@ startothers(void)
 
 __attribute__((__aligned__(PGSIZE)))
 pde_t entrypgdir[NPDENTRIES] = {
-  // Map VA's [0, 4MB) to PA's [0, 4MB)
+  // Map VA's [0, 8MB) to PA's [0, 8MB)
   [0] = (0) | PTE_P | PTE_W | PTE_PS,
-  // Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
+  [1] = (PDSIZE) | PTE_P | PTE_W | PTE_PS,
+  // Map VA's [KERNBASE, KERNBASE+8MB) to PA's [0, 8MB), leaving
+  // room after the kernel for kalloc.c's per-page arrays
   [KERNBASE>>PDXSHIFT] = (0) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+1] = (PDSIZE) | PTE_P | PTE_W | PTE_PS,
 };
 
 //PAGEBREAK!
@@ -0,0 +1,51 @@
+// Print memory statistics: physical pages, swap, and
+// the memory use and page faults of each process.
+//
+// usage: meminfo [seconds]
+// With an argument, print them again every so many seconds.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "meminfo.h"
+#include "user.h"
+
+struct meminfo mi;
+
+void
+print(void)
+{
+  struct procmem *pm;
+
+  if(meminfo(&mi) < 0){
+    printf(2, "meminfo: meminfo failed\n");
+    exit();
+  }
+  printf(1, "mem: %d pages, %d free, %d used, %d zeroed, %d failed allocs\n",
+         mi.npages, mi.nfree, mi.npages - mi.nfree, mi.nzero, mi.nfail);
+  printf(1, "low: %d pages free at least, %d oom kills\n",
+         mi.minfree, mi.noomkill);
+  printf(1, "swap: %d of %d slots used, %d in, %d out\n",
+         mi.swapused, mi.nswap, mi.swapin, mi.swapout);
+  printf(1, "pid\tname\tsize\trss\tswap\tminflt\tmajflt\tcow\n");
+  for(pm = mi.proc; pm < &mi.proc[mi.nproc]; pm++)
+    printf(1, "%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\n", pm->pid, pm->name,
+           pm->sz, pm->rss, pm->swap, pm->minflt, pm->majflt, pm->cowflt);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int secs;
+
+  secs = 0;
+  if(argc > 1)
+    secs = atoi(argv[1]);
+  for(;;){
+    print();
+    if(secs <= 0)
+      break;
+    sleep(secs * 100);
+  }
+  exit();
+}
@@ -0,0 +1,28 @@
+// Memory statistics returned by the meminfo system call.
+// Sizes are in pages unless noted.
+
+struct procmem {
+  int pid;
+  char name[16];
+  uint sz;       // Size of process memory (bytes)
+  uint rss;      // Resident pages
+  uint swap;     // Swapped-out pages
+  uint minflt;   // Page faults handled without I/O
+  uint majflt;   // Pages read back in from swap
+  uint cowflt;   // Copy-on-write breaks
+};
+
+struct meminfo {
+  uint npages;   // Physical pages managed by kalloc
+  uint nfree;    // Free pages
+  uint nzero;    // Pre-zeroed pages set aside for kalloc_zeroed
+  uint nfail;    // Failed allocations
+  uint minfree;  // Fewest free pages the allocator has seen
+  uint noomkill; // Processes killed for lack of memory
+  uint nswap;    // Swap slots
+  uint swapused; // Swap slots in use
+  uint swapin;   // Pages read from swap
+  uint swapout;  // Pages written to swap
+  int nproc;     // Entries used in proc[]
+  struct procmem proc[NPROC];
+};
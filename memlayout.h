@@ -1,12 +1,26 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
+#define PHYSTOP 0xE000000           // Top physical memory if the BIOS gives no map
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
+#define E820MAP 0x8000              // BIOS memory map left by bootasm.S
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
+#define MAXPHYS (DEVSPACE-KERNBASE) // Most physical memory the kernel can map
+
+// User address space layout:
+//   0..USERTOP: text, data and heap, grown by sbrk()
+//   USERTOP..STACKBASE: guard page, never mapped
+//   STACKBASE..STACKTOP: user stack, grown down on demand
+//                        (see growstack in vm.c)
+//   SHMBASE..KERNBASE: NSHMPROC slots of SHMMAXPG pages each
+//                      for attached shared memory segments (see shm.c)
+#define SHMBASE (KERNBASE - NSHMPROC*SHMMAXPG*PGSIZE)
+#define STACKTOP SHMBASE            // Top of user stack
+#define STACKBASE (STACKTOP - MAXSTACK) // Lowest possible user stack address
+#define USERTOP (STACKBASE - PGSIZE)  // End of sbrk()-able user memory
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
 #define P2V(a) ((void *)(((char *) (a)) + KERNBASE))
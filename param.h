@@ -2,13 +2,21 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#ifndef BCACHEFRAC
+#define BCACHEFRAC   8  // disk block cache may grow to 1/BCACHEFRAC of memory
+#endif
+#define FSSIZE       500  // size of file system in blocks
+#define SWAPSIZE     512  // size of swap area in blocks, after the file system
 
+#define MAXORDER     10  // largest kallocpages() block is 2^MAXORDER pages
+#define NSHM         16  // maximum shared memory segments per system
+#define NSHMPROC      8  // shared memory segments attached per process
+#define SHMMAXPG    256  // maximum pages in a shared memory segment
+#define MAXSTACK (1024*1024)  // maximum user stack size in bytes
+#define STACKGAP     4096  // how far below the stack or %esp it may grow
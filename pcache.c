@@ -0,0 +1,145 @@
+// Page cache for the read-only parts of programs.
+//
+// exec() maps the text and read-only data of a program
+// from pages kept here, named by (device, inode number,
+// offset, length), so every process running the same
+// program shares one copy of them.  The cache holds one
+// reference to each page (see kalloc.c) and each page
+// table that maps it holds another.
+//
+// Writing or truncating a file drops its pages from the
+// cache; processes already running it keep the old ones.
+// pcacheshrink() gives back pages that only the cache
+// holds when memory runs short.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mmu.h"
+
+#define NPBUCKET 64    // hash buckets, by file
+#define NPCACHE  1024  // maximum pages in cache
+
+struct ppage {
+  uint dev;
+  uint inum;
+  uint off;             // offset in file, page aligned
+  uint n;               // bytes read from file
+  char *page;
+  struct ppage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct ppage *bucket[NPBUCKET];
+  int n;                // pages in cache
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("pcache", sizeof(struct ppage));
+}
+
+static struct ppage**
+bucket(uint dev, uint inum)
+{
+  return &pcache.bucket[(dev*31 + inum) % NPBUCKET];
+}
+
+// Return a reference to the page holding the n bytes of ip
+// at off, followed by zeros, reading it in if it is not
+// cached yet.  Caller must hold ip->lock, which keeps other
+// processes from reading in the same page at the same time.
+// May sleep.  Returns 0 if it could not be read.
+char*
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct ppage *pp;
+  char *page;
+
+  acquire(&pcache.lock);
+  for(pp = *bucket(ip->dev, ip->inum); pp; pp = pp->next){
+    if(pp->dev == ip->dev && pp->inum == ip->inum &&
+       pp->off == off && pp->n == n){
+      page = kdup(pp->page);
+      release(&pcache.lock);
+      return page;
+    }
+  }
+  release(&pcache.lock);
+
+  if((page = swapalloc()) == 0)
+    return 0;
+  if(readi(ip, 0, page, off, n) != n){
+    kfree(page);
+    return 0;
+  }
+  if(pcache.n >= NPCACHE)
+    pcacheshrink();
+  if(pcache.n >= NPCACHE || (pp = kmem_cache_alloc(pcache.cache)) == 0)
+    return page;  // not cached, but still usable
+
+  pp->dev = ip->dev;
+  pp->inum = ip->inum;
+  pp->off = off;
+  pp->n = n;
+  pp->page = kdup(page);
+  acquire(&pcache.lock);
+  pp->next = *bucket(ip->dev, ip->inum);
+  *bucket(ip->dev, ip->inum) = pp;
+  pcache.n++;
+  release(&pcache.lock);
+  return page;
+}
+
+// Drop the cached pages of ip, whose contents are changing.
+void
+pcacheinval(struct inode *ip)
+{
+  struct ppage **ppp, *pp;
+
+  acquire(&pcache.lock);
+  for(ppp = bucket(ip->dev, ip->inum); (pp = *ppp) != 0; ){
+    if(pp->dev == ip->dev && pp->inum == ip->inum){
+      *ppp = pp->next;
+      pcache.n--;
+      kfree(pp->page);
+      kmem_cache_free(pcache.cache, pp);
+    } else
+      ppp = &pp->next;
+  }
+  release(&pcache.lock);
+}
+
+// Free the cached pages that no process has mapped.
+// Returns the number of pages freed.
+int
+pcacheshrink(void)
+{
+  struct ppage **ppp, *pp;
+  int i, n;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPBUCKET; i++){
+    for(ppp = &pcache.bucket[i]; (pp = *ppp) != 0; ){
+      if(krefcnt(pp->page) == 1){
+        *ppp = pp->next;
+        pcache.n--;
+        kfree(pp->page);
+        kmem_cache_free(pcache.cache, pp);
+        n++;
+      } else
+        ppp = &pp->next;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
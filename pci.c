@@ -0,0 +1,81 @@
+// PCI configuration space, through the
+// configuration mechanism #1 I/O ports.
+// Only bus 0 is scanned, which is all QEMU has.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFADDR  0xCF8
+#define PCI_CONFDATA  0xCFC
+
+#define PCI_ID        0x00
+#define PCI_COMMAND   0x04
+#define PCI_CLASS     0x08
+#define PCI_HEADER    0x0C
+#define PCI_BAR0      0x10
+#define PCI_INTR      0x3C
+
+#define PCI_CMD_IO     0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4  // may act as bus master (DMA)
+
+static uint
+confaddr(struct pcidev *d, int off)
+{
+  return 0x80000000 | d->bus<<16 | d->slot<<11 | d->func<<8 | (off & 0xFC);
+}
+
+// Read the 32-bit configuration register at off.
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_CONFADDR, confaddr(d, off));
+  return inl(PCI_CONFDATA);
+}
+
+// Write the 32-bit configuration register at off.
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_CONFADDR, confaddr(d, off));
+  outl(PCI_CONFDATA, v);
+}
+
+// Find the first function on bus 0 with vendor/device ID id,
+// unless id is 0, and with class/subclass class, unless class
+// is 0.  Fill in *d and return 0, or return -1 if none.
+int
+pcifind(uint id, uint class, struct pcidev *d)
+{
+  int i, nfunc;
+
+  d->bus = 0;
+  for(d->slot = 0; d->slot < 32; d->slot++){
+    nfunc = 1;
+    for(d->func = 0; d->func < nfunc; d->func++){
+      d->id = pciread(d, PCI_ID);
+      if((d->id & 0xFFFF) == 0xFFFF)
+        continue;
+      if(d->func == 0 && (pciread(d, PCI_HEADER) & 0x800000))
+        nfunc = 8;  // multi-function device
+      d->class = pciread(d, PCI_CLASS) >> 16;
+      if((id && d->id != id) || (class && d->class != class))
+        continue;
+      for(i = 0; i < 6; i++)
+        d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+      d->irq = pciread(d, PCI_INTR) & 0xFF;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Let d respond to I/O and memory accesses and do DMA.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_COMMAND, pciread(d, PCI_COMMAND) |
+           PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
@@ -0,0 +1,13 @@
+// PCI devices, found by pcifind() in pci.c.
+
+#define PCI_CLASS_IDE  0x0101  // mass storage, IDE
+
+struct pcidev {
+  int bus;
+  int slot;
+  int func;
+  uint id;        // vendor ID | device ID<<16
+  uint class;     // class<<8 | subclass
+  uint bar[6];    // base address registers
+  int irq;        // interrupt line
+};
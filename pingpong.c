@@ -0,0 +1,44 @@
+// Measure context switch cost: two processes bounce
+// a byte back and forth over a pair of pipes, so every
+// round trip is two switches from one process to the other.
+//
+// usage: pingpong [rounds]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int ping[2], pong[2], rounds, i, start, t;
+  char c;
+
+  rounds = 10000;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "pingpong: pipe failed\n");
+    exit();
+  }
+  start = uptime();
+  if(fork() == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+  c = 'x';
+  for(i = 0; i < rounds; i++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1)
+      break;
+  }
+  wait();
+  t = uptime() - start;
+  printf(1, "pingpong: %d round trips in %d ticks\n", i, t);
+  exit();
+}
@@ -19,6 +19,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
@@ -48,7 +56,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    kmem_cache_free(pipecache, p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,19 +77,21 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kmem_cache_free(pipecache, p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Copy n bytes from user address addr into the pipe,
+// as much at a time as fits before the end of the buffer.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
@@ -90,17 +100,28 @@ pipewrite(struct pipe *p, char *addr, int n)
       wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = n - i;
+    if(m > p->nread + PIPESIZE - p->nwrite)
+      m = p->nread + PIPESIZE - p->nwrite;
+    if(m > PIPESIZE - p->nwrite % PIPESIZE)
+      m = PIPESIZE - p->nwrite % PIPESIZE;
+    if(copyin(myproc()->pgdir, &p->data[p->nwrite % PIPESIZE],
+              (uint)addr + i, m) < 0){
+      release(&p->lock);
+      return -1;
+    }
+    p->nwrite += m;
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
+// Copy up to n bytes from the pipe to user address addr.
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,10 +131,16 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    if(m > PIPESIZE - p->nread % PIPESIZE)
+      m = PIPESIZE - p->nread % PIPESIZE;
+    if(copyout(myproc()->pgdir, (uint)addr + i,
+               &p->data[p->nread % PIPESIZE], m) < 0)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    p->nread += m;
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
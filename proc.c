@@ -6,11 +6,17 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
 
+// Process structures come from a slab cache (see slab.c)
+// and are linked on ptable.head while in use.  At most
+// NPROC of them exist at a time.
 struct
 {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct kmem_cache *cache;
+  struct proc *head;
+  int nproc;
 } ptable;
 
 static struct proc *initproc;
@@ -18,12 +24,15 @@ static struct proc *initproc;
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
+static void kthreadret(void);
 
 static void wakeup1(void *chan);
+static char idlechan; // see idlewait()
 
 void pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  ptable.cache = kmem_cache_create("proc", sizeof(struct proc));
 }
 
 // Must be called with interrupts disabled
@@ -68,9 +77,23 @@ myproc(void)
   return p;
 }
 
+// Remove p from the process table and free it.
+// Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for (pp = &ptable.head; *pp != p; pp = &(*pp)->next)
+    ;
+  *pp = p->next;
+  ptable.nproc--;
+  kmem_cache_free(ptable.cache, p);
+}
+
 // PAGEBREAK: 32
-//  Look in the process table for an UNUSED proc.
-//  If found, change state to EMBRYO and initialize
+//  Allocate a new proc and add it to the process table.
+//  If successful, change state to EMBRYO and initialize
 //  state required to run in the kernel.
 //  Otherwise return 0.
 static struct proc *
@@ -78,17 +101,21 @@ allocproc(void)
 {
   struct proc *p;
   char *sp;
-  acquire(&ptable.lock);
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if (p->state == UNUSED)
-      goto found;
-  }
+  if ((p = kmem_cache_alloc(ptable.cache)) == 0)
+    return 0;
 
-  release(&ptable.lock);
-  return 0;
+  acquire(&ptable.lock);
+  if (ptable.nproc >= NPROC)
+  {
+    release(&ptable.lock);
+    kmem_cache_free(ptable.cache, p);
+    return 0;
+  }
+  ptable.nproc++;
+  p->next = ptable.head;
+  ptable.head = p;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
   p->nice = 20; // nice값 20으로 초기화
@@ -98,7 +125,9 @@ found:
   // Allocate kernel stack.
   if ((p->kstack = kalloc()) == 0)
   {
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -134,6 +163,7 @@ void userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  p->stack = STACKTOP; // initcode's stack is in its one page
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -157,6 +187,25 @@ void userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread running fn, which must never return.
+// It has no user memory; its page table maps just the kernel.
+void kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kthread");
+  if ((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory?");
+  p->kfn = fn;
+  p->context->eip = (uint)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
@@ -180,6 +229,29 @@ int growproc(int n)
   return 0;
 }
 
+// Grow current process's memory by n bytes of 4 MB pages,
+// after filling out its last 4 MB with ordinary pages.
+// Return the address of the new memory, or -1 on failure.
+int growhuge(int n)
+{
+  uint sz, start;
+  struct proc *curproc = myproc();
+
+  if (n <= 0)
+    return -1;
+  start = PDROUNDUP(curproc->sz);
+  if ((sz = allocuvm(curproc->pgdir, curproc->sz, start)) == 0)
+    return -1;
+  if ((sz = allochugeuvm(curproc->pgdir, start, start + n)) == 0)
+  {
+    deallocuvm(curproc->pgdir, start, curproc->sz);
+    return -1;
+  }
+  curproc->sz = sz;
+  switchuvm(curproc);
+  return start;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -196,14 +268,25 @@ int fork(void)
   }
 
   // Copy process state from proc.
-  if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
+  if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, curproc->stack)) == 0)
+  {
+    kfree(np->kstack);
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  if (shmfork(np, curproc) < 0)
   {
+    freevm(np->pgdir);
     kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
+  np->stack = curproc->stack;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -258,13 +341,16 @@ void exit(void)
   end_op();
   curproc->cwd = 0;
 
+  shmexit(curproc);
+  shmorphan(curproc);
+
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
   {
     if (p->parent == curproc)
     {
@@ -293,7 +379,7 @@ int wait(void)
   {
     // Scan through table looking for exited children.
     havekids = 0;
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for (p = ptable.head; p; p = p->next)
     {
       if (p->parent != curproc)
         continue;
@@ -303,13 +389,8 @@ int wait(void)
         // Found one.
         pid = p->pid;
         kfree(p->kstack);
-        p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -323,7 +404,9 @@ int wait(void)
     }
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    curproc->swapok = 1;
     sleep(curproc, &ptable.lock); // DOC: wait-sleep
+    curproc->swapok = 0;
   }
 }
 
@@ -339,6 +422,7 @@ void scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int uvm;
   c->proc = 0;
 
   for (;;)
@@ -348,7 +432,8 @@ void scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    uvm = 0;
+    for (p = ptable.head; p; p = p->next)
     {
       if (p->state != RUNNABLE)
         continue;
@@ -361,12 +446,20 @@ void scheduler(void)
       p->state = RUNNING;
 
       swtch(&(c->scheduler), p->context);
-      switchkvm();
+      uvm = 1;
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
     }
+    // Keep using the last process's page table while going
+    // straight on to the next process, which saves a TLB flush.
+    // Its page table can only be freed (by wait or exec) once
+    // ptable.lock is released, so switch away before that.
+    if (uvm)
+      switchkvm();
+    else if (kzerowanted())
+      wakeup1(&idlechan); // nothing to run: time for idle work
     release(&ptable.lock);
   }
 }
@@ -405,6 +498,142 @@ void yield(void)
   release(&ptable.lock);
 }
 
+// Choose a user page to swap out, using the clock algorithm
+// over the pages of all processes that are stopped with
+// swapok set, and replace its PTE with npte.  Two passes are
+// enough to come back to pages whose PTE_A was cleared.
+// Returns the page, or 0 if no page can be swapped out.
+char *swapvictim(uint npte)
+{
+  static int handpid; // clock hand: process and address
+  static uint handva;
+  struct proc *p;
+  char *v;
+  int n;
+
+  acquire(&ptable.lock);
+  for (p = ptable.head; p; p = p->next)
+    if (p->pid == handpid)
+      break;
+  if (p == 0)
+  {
+    p = ptable.head;
+    handva = 0;
+  }
+  for (n = 2 * ptable.nproc + 1; n > 0; n--)
+  {
+    // A process that isn't running, and whose pages the
+    // kernel isn't using, can't touch its page table.
+    if (p->swapok && p->state != RUNNING && p->pgdir &&
+        (v = evictuvm(p->pgdir, p->sz, &handva, npte)) != 0)
+    {
+      handpid = p->pid;
+      release(&ptable.lock);
+      return v;
+    }
+    handva = 0;
+    if ((p = p->next) == 0)
+      p = ptable.head;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+#define OOMGRACE 50 // ticks a killed process has to exit
+
+static uint noomkill; // processes killed by oomkill()
+
+// Out of memory: kill the process whose resident pages,
+// weighted by its nice value, are the most, so that batch
+// jobs (high nice) go before services (low nice).  init
+// is never killed.  Returns 0 if a process was killed, or
+// an earlier victim has yet to give back its memory, and
+// -1 if there is nothing to kill.  A victim that has not
+// exited within OOMGRACE ticks, say because it sleeps on
+// something that never comes, is passed over.
+int oomkill(void)
+{
+  struct proc *p, *victim;
+  uint rss, nswap, score, best;
+
+  acquire(&ptable.lock);
+  victim = 0;
+  best = 0;
+  for (p = ptable.head; p; p = p->next)
+  {
+    if (p == initproc || p->pgdir == 0 ||
+        p->state == UNUSED || p->state == EMBRYO ||
+        p->state == ZOMBIE)
+      continue;
+    if (p->killed)
+    {
+      if (ticks - p->killtick < OOMGRACE)
+      {
+        // Its memory comes back when it exits.
+        release(&ptable.lock);
+        return 0;
+      }
+      continue;
+    }
+    countuvm(p->pgdir, &rss, &nswap);
+    score = rss * (p->nice + 1);
+    if (score > best)
+    {
+      best = score;
+      victim = p;
+    }
+  }
+  if (victim == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  victim->killed = 1;
+  victim->killtick = ticks;
+  if (victim->state == SLEEPING)
+    victim->state = RUNNABLE;
+  noomkill++;
+  cprintf("oom: killed pid %d (%s), nice %d\n",
+          victim->pid, victim->name, victim->nice);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Fill in the per-process part of mi.
+void procmemstat(struct meminfo *mi)
+{
+  struct proc *p;
+  struct procmem *pm;
+
+  acquire(&ptable.lock);
+  mi->noomkill = noomkill;
+  mi->nproc = 0;
+  for (p = ptable.head; p && mi->nproc < NPROC; p = p->next)
+  {
+    pm = &mi->proc[mi->nproc++];
+    pm->pid = p->pid;
+    safestrcpy(pm->name, p->name, sizeof(pm->name));
+    pm->sz = p->sz;
+    pm->rss = pm->swap = 0;
+    if (p->pgdir)
+      countuvm(p->pgdir, &pm->rss, &pm->swap);
+    pm->minflt = p->minflt;
+    pm->majflt = p->majflt;
+    pm->cowflt = p->cowflt;
+  }
+  release(&ptable.lock);
+}
+
+// Sleep until a CPU finds no process to run while there is
+// idle work to do (see scheduler).  Lets kernel threads do
+// their work in idle time.
+void idlewait(void)
+{
+  acquire(&ptable.lock);
+  sleep(&idlechan, &ptable.lock);
+  release(&ptable.lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void forkret(void)
@@ -421,11 +650,23 @@ void forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch here.  Run its body, which never returns.
+static void kthreadret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
@@ -474,7 +715,7 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
     if (p->state == SLEEPING && p->chan == chan)
       p->state = RUNNABLE;
 }
@@ -495,11 +736,12 @@ int kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
   {
     if (p->pid == pid)
     {
       p->killed = 1;
+      p->killtick = ticks;
       // Wake process from sleep if necessary.
       if (p->state == SLEEPING)
         p->state = RUNNABLE;
@@ -511,6 +753,28 @@ int kill(int pid)
   return -1;
 }
 
+// Copy to either a user address, or kernel address,
+// depending on user_dst.
+// Returns 0 on success, -1 on error.
+int either_copyout(int user_dst, char *dst, void *src, uint len)
+{
+  if (user_dst)
+    return copyout(myproc()->pgdir, (uint)dst, src, len);
+  memmove(dst, src, len);
+  return 0;
+}
+
+// Copy from either a user address, or kernel address,
+// depending on user_src.
+// Returns 0 on success, -1 on error.
+int either_copyin(void *dst, int user_src, char *src, uint len)
+{
+  if (user_src)
+    return copyin(myproc()->pgdir, dst, (uint)src, len);
+  memmove(dst, src, len);
+  return 0;
+}
+
 // PAGEBREAK: 36
 //  Print a process listing to console.  For debugging.
 //  Runs when user types ^P on console.
@@ -529,7 +793,7 @@ void procdump(void)
   char *state;
   uint pc[10];
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
   {
     if (p->state == UNUSED)
       continue;
@@ -554,7 +818,7 @@ int getpname(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
   {
     if (p->pid == pid)
     {
@@ -577,7 +841,7 @@ int getnice(int pid)
   acquire(&ptable.lock);
 
   // ptable의 모든 프로세스에서 검색
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
   {
     if (p->pid == pid)
     { // pid가 일치하면
@@ -599,7 +863,7 @@ int setnice(int pid, int value)
   acquire(&ptable.lock);
 
   // ptable의 모든 프로세스에서 검색
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.head; p; p = p->next)
   {
     if (p->pid == pid)
     { // pid가 일치하면
@@ -631,7 +895,7 @@ void ps(int pid)
   if (pid == 0)
   {
     cprintf("name\t\t\tpid\t\t\tstate   \t\t\tpriority\n");
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for (p = ptable.head; p; p = p->next)
     {
       //상태를 문자열로 변환
       switch (p->state) {
@@ -660,7 +924,7 @@ void ps(int pid)
   else
   {
     // pid가 0이 아니면 해당 프로세스의 정보를 출력
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for (p = ptable.head; p; p = p->next)
     {
       // pid가 일치하면 해당 프로세스의 정보를 출력
       if (p->pid == pid)
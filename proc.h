@@ -37,6 +37,7 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
+  uint stack;                  // Bottom of user stack
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
@@ -46,10 +47,18 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
+  uint killtick;               // ticks when killed was set (see oomkill)
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   int nice;                    // nice value(0~39) proj2에서 추가
+  struct shm *shm[NSHMPROC];   // Attached shared memory segments
+  struct proc *next;           // Process table list
+  int swapok;                  // If non-zero, pages may be swapped out
+  uint minflt;                 // Page faults handled without I/O
+  uint majflt;                 // Pages read back in from swap
+  uint cowflt;                 // Copy-on-write breaks
+  void (*kfn)(void);           // Kernel thread body (see kthread)
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,257 @@
+// Shared memory segments.
+//
+// A segment is a set of physical pages named by a key.
+// shmget() finds or creates the segment for a key,
+// shmat() maps its pages into the calling process at
+// one of NSHMPROC fixed slots above USERTOP, and shmdt()
+// unmaps it again.  The pages themselves are reference
+// counted by kalloc.c: the segment holds one reference
+// and every page table that maps the page holds another,
+// so a page stays allocated until the segment is gone
+// and the last process mapping it has been freed.
+//
+// A segment is destroyed when its last attachment goes
+// away, either through shmdt() or through exit() / exec(),
+// or when the process that created it exits without it
+// ever having been attached.  Attachments are inherited
+// across fork().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shm {
+  int valid;              // segment exists
+  int key;                // name given to shmget()
+  int nattach;            // number of attachments
+  int creator;            // pid of creator until first attached
+  int npages;             // size of segment in pages
+  char *pages[SHMMAXPG];  // kernel addresses of the pages
+};
+
+struct {
+  struct spinlock lock;
+  struct shm seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Free the pages of a segment with no attachments.
+// Caller must hold shmtable.lock.
+static void
+shmfree(struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++){
+    kfree(s->pages[i]);
+    s->pages[i] = 0;
+  }
+  s->npages = 0;
+  s->key = 0;
+  s->creator = 0;
+  s->valid = 0;
+}
+
+// Return the id of the segment named key, creating it with
+// size bytes of zeroed memory if it does not exist yet.
+// Returns -1 if the segment is too small or cannot be created.
+int
+shmget(int key, int size)
+{
+  struct shm *s, *empty;
+  int npages;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(size <= 0 || npages > SHMMAXPG)
+    return -1;
+
+  acquire(&shmtable.lock);
+  empty = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->valid && s->key == key){
+      release(&shmtable.lock);
+      if(s->npages < npages)
+        return -1;
+      return s - shmtable.seg;
+    }
+    if(empty == 0 && !s->valid)
+      empty = s;
+  }
+  if(empty == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+
+  s = empty;
+  for(s->npages = 0; s->npages < npages; s->npages++){
+    if((s->pages[s->npages] = kalloc_zeroed()) == 0){
+      shmfree(s);
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  s->key = key;
+  s->nattach = 0;
+  s->creator = myproc()->pid;
+  s->valid = 1;
+  release(&shmtable.lock);
+  return s - shmtable.seg;
+}
+
+// User address of attachment slot i.
+static uint
+shmva(int i)
+{
+  return SHMBASE + i*SHMMAXPG*PGSIZE;
+}
+
+// Map segment s at slot i of p.  Caller must hold shmtable.lock.
+static int
+shmmap(struct proc *p, int i, struct shm *s)
+{
+  if(shareuvm(p->pgdir, shmva(i), s->pages, s->npages) < 0)
+    return -1;
+  s->nattach++;
+  s->creator = 0;
+  p->shm[i] = s;
+  return 0;
+}
+
+// Drop attachment slot i of p without touching its page
+// table.  Caller must hold shmtable.lock.
+static void
+shmdrop(struct proc *p, int i)
+{
+  struct shm *s;
+
+  s = p->shm[i];
+  p->shm[i] = 0;
+  if(--s->nattach == 0)
+    shmfree(s);
+}
+
+// Attach segment id to the current process.
+// Returns the user address of the segment, or -1.
+int
+shmat(int id)
+{
+  struct proc *curproc = myproc();
+  struct shm *s;
+  int i;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+
+  acquire(&shmtable.lock);
+  s = &shmtable.seg[id];
+  if(!s->valid)
+    goto bad;
+  for(i = 0; i < NSHMPROC; i++)
+    if(curproc->shm[i] == 0)
+      break;
+  if(i == NSHMPROC || shmmap(curproc, i, s) < 0)
+    goto bad;
+  release(&shmtable.lock);
+  switchuvm(curproc);
+  return shmva(i);
+
+bad:
+  release(&shmtable.lock);
+  return -1;
+}
+
+// Detach the segment attached at user address va.
+int
+shmdt(uint va)
+{
+  struct proc *curproc = myproc();
+  struct shm *s;
+  int i;
+
+  for(i = 0; i < NSHMPROC; i++)
+    if(curproc->shm[i] && shmva(i) == va)
+      break;
+  if(i == NSHMPROC)
+    return -1;
+
+  acquire(&shmtable.lock);
+  s = curproc->shm[i];
+  deallocuvm(curproc->pgdir, va + s->npages*PGSIZE, va);
+  shmdrop(curproc, i);
+  release(&shmtable.lock);
+  switchuvm(curproc);
+  return 0;
+}
+
+// Return the end of the segment attached to the current
+// process that holds user address va, or 0 if there is none.
+uint
+shmend(uint va)
+{
+  struct proc *curproc = myproc();
+  struct shm *s;
+  int i;
+
+  if(va < SHMBASE || va >= KERNBASE)
+    return 0;
+  i = (va - SHMBASE) / (SHMMAXPG*PGSIZE);
+  if((s = curproc->shm[i]) == 0 || va >= shmva(i) + s->npages*PGSIZE)
+    return 0;
+  return shmva(i) + s->npages*PGSIZE;
+}
+
+// Give child np the attachments of its parent p.
+// Returns 0 on success, -1 with nothing attached on error.
+int
+shmfork(struct proc *np, struct proc *p)
+{
+  int i;
+
+  acquire(&shmtable.lock);
+  for(i = 0; i < NSHMPROC; i++){
+    if(p->shm[i] && shmmap(np, i, p->shm[i]) < 0){
+      release(&shmtable.lock);
+      shmexit(np);
+      return -1;
+    }
+  }
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Drop all attachments of p, e.g. when it exits or execs.
+// The mappings themselves go away with p's old page table.
+void
+shmexit(struct proc *p)
+{
+  int i;
+
+  acquire(&shmtable.lock);
+  for(i = 0; i < NSHMPROC; i++)
+    if(p->shm[i])
+      shmdrop(p, i);
+  release(&shmtable.lock);
+}
+
+// Destroy the segments that exiting process p created and
+// nobody ever attached; no one else is likely to find them.
+void
+shmorphan(struct proc *p)
+{
+  struct shm *s;
+
+  acquire(&shmtable.lock);
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++)
+    if(s->valid && s->creator == p->pid)
+      shmfree(s);
+  release(&shmtable.lock);
+}
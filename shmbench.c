@@ -0,0 +1,101 @@
+// Compare the throughput of pipes and shared memory
+// for moving data from one process to another.
+//
+// usage: shmbench [megabytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define CHUNK   512
+#define RINGSZ  (32*1024)
+#define SHMKEY  0x5348
+
+// Single-producer, single-consumer ring in shared memory.
+struct ring {
+  volatile uint head;   // bytes written by producer
+  volatile uint tail;   // bytes consumed by consumer
+  char data[RINGSZ];
+};
+
+char buf[CHUNK];
+
+int
+pipebench(int total)
+{
+  int fds[2], n, start;
+
+  if(pipe(fds) < 0){
+    printf(2, "shmbench: pipe failed\n");
+    exit();
+  }
+  start = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += CHUNK)
+      write(fds[1], buf, CHUNK);
+    close(fds[1]);
+    exit();
+  }
+  close(fds[1]);
+  for(n = 0; n < total; ){
+    int m = read(fds[0], buf, CHUNK);
+    if(m <= 0)
+      break;
+    n += m;
+  }
+  close(fds[0]);
+  wait();
+  return uptime() - start;
+}
+
+int
+shmbench(int total)
+{
+  struct ring *r;
+  int id, n, start;
+
+  if((id = shmget(SHMKEY, sizeof(struct ring))) < 0 ||
+     (r = (struct ring*)shmat(id)) == (struct ring*)-1){
+    printf(2, "shmbench: shmget/shmat failed\n");
+    exit();
+  }
+  r->head = r->tail = 0;
+  start = uptime();
+  if(fork() == 0){
+    for(n = 0; n < total; n += CHUNK){
+      while(r->head - r->tail > RINGSZ - CHUNK)
+        ;
+      memmove(r->data + r->head % RINGSZ, buf, CHUNK);
+      r->head += CHUNK;
+    }
+    exit();
+  }
+  for(n = 0; n < total; n += CHUNK){
+    while(r->head == r->tail)
+      ;
+    memmove(buf, r->data + r->tail % RINGSZ, CHUNK);
+    r->tail += CHUNK;
+  }
+  wait();
+  n = uptime() - start;
+  shmdt(r);
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, total, t;
+
+  mb = 4;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  total = mb * 1024 * 1024;
+
+  t = pipebench(total);
+  printf(1, "pipe: %d MB in %d ticks\n", mb, t);
+  t = shmbench(total);
+  printf(1, "shm:  %d MB in %d ticks\n", mb, t);
+  exit();
+}
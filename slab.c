@@ -0,0 +1,233 @@
+// Slab allocator for small fixed-size kernel objects.
+//
+// A kmem_cache hands out objects of one size.  Objects are
+// carved out of slabs: blocks of 2^order pages obtained from
+// kallocpages(), with a struct slab header at the start of
+// the block.  Since slabs are aligned to their size, the
+// slab holding an object is found by rounding the object's
+// address down.  Slabs with free objects sit on the cache's
+// partial list; a slab whose objects are all free is given
+// back to kalloc.c, so memory use follows the live objects.
+//
+// In front of the slabs, each CPU has a magazine of up to
+// MAGSIZE free objects, so most allocations and frees touch
+// only CPU-local state.  A CPU refills or flushes half a
+// magazine at a time under the cache's lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NCACHE   16  // maximum number of caches
+#define MAGSIZE  16  // objects per CPU magazine
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct slab *next;        // partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  struct obj *freelist;     // free objects in this slab
+  int inuse;                // objects handed out
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;                // object size
+  int order;                // slab is 2^order pages
+  int perslab;              // objects per slab
+  struct spinlock lock;
+  struct slab partial;      // slabs with free objects
+  int nslab;                // slabs allocated
+  int nobj;                 // objects outside the slabs
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache cache[NCACHE];
+} slabtable;
+
+void
+slabinit(void)
+{
+  initlock(&slabtable.lock, "slabtable");
+}
+
+// Create a cache of objects of size bytes.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  acquire(&slabtable.lock);
+  if(slabtable.n == NCACHE)
+    panic("kmem_cache_create");
+  c = &slabtable.cache[slabtable.n++];
+  release(&slabtable.lock);
+
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = (size + sizeof(struct obj*) - 1) & ~(sizeof(struct obj*) - 1);
+  // Smallest slab that holds at least 8 objects.
+  for(c->order = 0; c->order < MAXORDER; c->order++)
+    if(((PGSIZE << c->order) - sizeof(struct slab)) / c->size >= 8)
+      break;
+  c->perslab = ((PGSIZE << c->order) - sizeof(struct slab)) / c->size;
+  if(c->perslab < 1)
+    panic("kmem_cache_create: too big");
+  c->partial.next = c->partial.prev = &c->partial;
+  initlock(&c->lock, name);
+  return c;
+}
+
+// Allocate a new slab for c and put it on the partial list.
+// Caller must hold c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct obj *o;
+  char *p;
+  int i;
+
+  if((p = kallocpages(c->order)) == 0)
+    return 0;
+  s = (struct slab*)p;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = (struct obj*)(p + sizeof(struct slab) + i*c->size);
+    o->next = s->freelist;
+    s->freelist = o;
+  }
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+  c->nslab++;
+  return s;
+}
+
+// Take one object from the slabs.  Caller must hold c->lock.
+static void*
+slabget(struct kmem_cache *c)
+{
+  struct slab *s;
+  struct obj *o;
+
+  s = c->partial.next;
+  if(s == &c->partial && (s = slabgrow(c)) == 0)
+    return 0;
+  o = s->freelist;
+  s->freelist = o->next;
+  if(++s->inuse == c->perslab){
+    // Full: take it off the partial list.
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    s->next = s->prev = 0;
+  }
+  c->nobj++;
+  return o;
+}
+
+// Return one object to its slab.  Caller must hold c->lock.
+static void
+slabput(struct kmem_cache *c, void *v)
+{
+  struct slab *s;
+  struct obj *o;
+
+  s = (struct slab*)((uint)v & ~((PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("slabput");
+  if(s->inuse-- == c->perslab){
+    // Was full: back on the partial list.
+    s->next = c->partial.next;
+    s->prev = &c->partial;
+    c->partial.next->prev = s;
+    c->partial.next = s;
+  }
+  o = (struct obj*)v;
+  o->next = s->freelist;
+  s->freelist = o;
+  c->nobj--;
+  if(s->inuse == 0){
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    c->nslab--;
+    kfreepages((char*)s, c->order);
+  }
+}
+
+// Allocate a zeroed object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *v;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (v = slabget(c)) != 0)
+      m->obj[m->n++] = v;
+    release(&c->lock);
+  }
+  v = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  if(v)
+    memset(v, 0, c->size);
+  return v;
+}
+
+// Free an object returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *v)
+{
+  struct magazine *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = v;
+  popcli();
+}
+
+// Print per-cache statistics to the console.
+// No lock to avoid wedging a stuck machine further.
+void
+slabdump(void)
+{
+  struct kmem_cache *c;
+  int i, cached;
+
+  for(c = slabtable.cache; c < &slabtable.cache[slabtable.n]; c++){
+    cached = 0;
+    for(i = 0; i < ncpu; i++)
+      cached += c->mag[i].n;
+    cprintf("%s: size %d slabs %d (%d pages) live %d cached %d\n",
+            c->name, c->size, c->nslab, c->nslab << c->order,
+            c->nobj - cached, cached);
+  }
+}
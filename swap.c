@@ -0,0 +1,219 @@
+// Swapping of user pages to the swap area of the disk.
+//
+// When memory runs out, swapalloc() evicts a page of some
+// other process that is stopped at a point where the kernel
+// holds no pointers into its memory (see swapvictim() in
+// proc.c), chosen with the clock algorithm over PTE_A bits.
+// The page's contents go to a free page-sized slot of the
+// swap area that mkfs leaves after the file system, and the
+// PTE is replaced by one without PTE_P that has PTE_SWAP
+// set and holds the slot number in place of the address.
+// A user page fault on such a PTE reads the page back in.
+//
+// When nothing more can be swapped out, swapalloc() has
+// oomkill() in proc.c kill a process and waits a while for
+// its memory to come back.
+//
+// All swap I/O is serialized by swap.iolock.  A page is
+// unmapped before it is written out, and swapout() holds
+// iolock from then until the write is done, so swapread()
+// of a slot always sees its complete contents.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "meminfo.h"
+
+extern struct superblock sb;
+
+#define BPP   (PGSIZE/BSIZE)      // blocks per page
+#define NSLOT (SWAPSIZE/BPP)      // page-sized slots in swap area
+#define OOMWAIT 100               // ticks to wait for an OOM kill
+
+struct {
+  struct spinlock lock;     // protects slot[]
+  struct sleeplock iolock;  // serializes swap I/O
+  uint dev;
+  uint start;               // first block of swap area
+  int nslot;                // usable slots
+  int nused;                // slots in use
+  uint nout;                // pages swapped out
+  uint nin;                 // pages swapped in
+  uchar slot[NSLOT];        // slot in use?
+} swap;
+
+// Find the swap area on dev.  Must be called after iinit(),
+// which reads the superblock; until then nothing is swapped.
+void
+swapinit(int dev)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / BPP;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+static int
+slotalloc(void)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    if(!swap.slot[i]){
+      swap.slot[i] = 1;
+      swap.nused++;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Free a swap slot whose page is no longer needed.
+void
+swapfree(int i)
+{
+  if(i < 0 || i >= swap.nslot)
+    panic("swapfree");
+  acquire(&swap.lock);
+  if(!swap.slot[i])
+    panic("swapfree: free slot");
+  swap.slot[i] = 0;
+  swap.nused--;
+  release(&swap.lock);
+}
+
+// Copy a page between memory and slot i.
+// Caller must hold swap.iolock.
+static void
+swaprw(int i, char *mem, int write)
+{
+  struct buf *b;
+  int j;
+
+  for(j = 0; j < BPP; j++){
+    b = bread(swap.dev, swap.start + i*BPP + j);
+    if(write){
+      memmove(b->data, mem + j*BSIZE, BSIZE);
+      bwrite(b);
+    } else
+      memmove(mem + j*BSIZE, b->data, BSIZE);
+    brelse(b);
+  }
+}
+
+// Read the contents of slot i into the page mem.
+void
+swapread(int i, char *mem)
+{
+  acquiresleep(&swap.iolock);
+  swaprw(i, mem, 0);
+  swap.nin++;
+  releasesleep(&swap.iolock);
+}
+
+// Write one page of another process out to swap and free it.
+// Returns -1 if there is no free slot or no page to evict.
+static int
+swapout(void)
+{
+  char *mem;
+  int i;
+
+  if((i = slotalloc()) < 0)
+    return -1;
+  acquiresleep(&swap.iolock);
+  if((mem = swapvictim((i << PTXSHIFT) | PTE_SWAP)) == 0){
+    releasesleep(&swap.iolock);
+    swapfree(i);
+    return -1;
+  }
+  swaprw(i, mem, 1);
+  swap.nout++;
+  releasesleep(&swap.iolock);
+  kfree(mem);
+  return 0;
+}
+
+// Make room for user memory: drop unused cached program
+// pages and disk blocks, then swap out other processes'
+// pages, and as a last resort kill a process and wait a
+// tick for its memory.  *t counts the waits.  Returns 0 to
+// try the allocation again, or -1 to give up.
+static int
+swapreclaim(int *t)
+{
+  if(pcacheshrink() > 0 || bshrink() > 0 || swapout() == 0)
+    return 0;
+  if((*t)++ >= OOMWAIT || oomkill() < 0 || myproc()->killed)
+    return -1;
+  acquire(&tickslock);
+  sleep(&ticks, &tickslock);
+  release(&tickslock);
+  return 0;
+}
+
+// Allocate a zeroed page for user memory, leaving the pages
+// below kalloc's low watermark to the kernel, and reclaiming
+// memory as swapreclaim() describes if need be.
+// May sleep, so the caller must not hold any spinlock.
+// Returns 0 if the memory cannot be allocated, or if the
+// caller was the one killed.
+char*
+swapalloc(void)
+{
+  char *mem;
+  int t;
+
+  for(t = 0; ; ){
+    if(!kmemlow(1) && (mem = kalloc_zeroed()) != 0)
+      return mem;
+    if(swapreclaim(&t) < 0)
+      return 0;
+  }
+}
+
+// Like swapalloc, but allocate 2^order contiguous pages
+// with kallocpages(), not zeroed.  If enough memory is free
+// but not in one block, only freeing cached pages can help;
+// swapping out or killing processes is unlikely to.
+char*
+swapallocpages(int order)
+{
+  char *mem;
+  int t;
+
+  for(t = 0; ; ){
+    if(!kmemlow(1 << order)){
+      if((mem = kallocpages(order)) != 0)
+        return mem;
+      if(pcacheshrink() > 0 || bshrink() > 0)
+        continue;
+      return 0;
+    }
+    if(swapreclaim(&t) < 0)
+      return 0;
+  }
+}
+
+// Fill in the swap counts of mi.
+void
+swapstat(struct meminfo *mi)
+{
+  mi->nswap = swap.nslot;
+  mi->swapused = swap.nused;
+  mi->swapin = swap.nin;
+  mi->swapout = swap.nout;
+}
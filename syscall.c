@@ -13,13 +13,53 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// The kernel reads and writes user memory directly, so the
+// helpers below make sure it is not swapped out.  It stays in
+// memory until the system call returns (see swapvictim).
+static int
+resident(uint addr, uint n)
+{
+  struct proc *curproc = myproc();
+  int nin;
+
+  if((nin = swapinuvm(curproc->pgdir, addr, n)) < 0)
+    return -1;
+  curproc->majflt += nin;
+  return 0;
+}
+
+// Return the end of the part of the current process's memory
+// that holds addr: the memory below sz, an attached shared
+// memory segment, or the stack, which is grown down to addr
+// if need be and addr is close enough (see growstack).
+// Returns 0 if addr is in none of them.
+static uint
+uend(uint addr)
+{
+  struct proc *curproc = myproc();
+  uint end;
+
+  if(addr < curproc->sz)
+    return curproc->sz;
+  if((end = shmend(addr)) != 0)
+    return end;
+  if(addr >= curproc->stack && addr < STACKTOP)
+    return STACKTOP;
+  if(growstack(curproc->pgdir, &curproc->stack, addr,
+               curproc->tf->esp) == 0)
+    return STACKTOP;
+  return 0;
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if((end = uend(addr)) == 0 || addr+4 > end)
+    return -1;
+  if(resident(addr, 4) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -32,13 +72,15 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
-  struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  // Another process could change a string in shared memory
+  // after it has been checked.
+  if(shmend(addr) != 0 || (ep = (char*)uend(addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && resident((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -59,20 +101,34 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
- 
+  uint end;
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (end = uend(i)) == 0 || (uint)i+size > end)
+    return -1;
+  if(resident(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Like argptr, for memory the system call will store into:
+// also check that the user may write it.
+int
+argptrw(int n, char **pp, int size)
+{
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  if(!uwritable(myproc()->pgdir, (uint)*pp, size))
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (fetchstr refuses strings in shared memory, so the string can't
+// change between this check and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -107,6 +163,12 @@ extern int sys_getpname(void);
 extern int sys_getnice(void);
 extern int sys_setnice(void);
 extern int sys_ps(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_meminfo(void);
+extern int sys_sbrkhuge(void);
+extern int sys_bcstat(void);
 
 
 static int (*syscalls[])(void) = {
@@ -135,6 +197,12 @@ static int (*syscalls[])(void) = {
 [SYS_getnice]   sys_getnice,
 [SYS_setnice]   sys_setnice,
 [SYS_ps]   sys_ps,
+[SYS_shmget] sys_shmget,
+[SYS_shmat]  sys_shmat,
+[SYS_shmdt]  sys_shmdt,
+[SYS_meminfo] sys_meminfo,
+[SYS_sbrkhuge] sys_sbrkhuge,
+[SYS_bcstat]  sys_bcstat,
 };
 
 void
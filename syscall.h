@@ -24,3 +24,9 @@
 #define SYS_getnice  23
 #define SYS_setnice  24
 #define SYS_ps  25
+#define SYS_shmget 26
+#define SYS_shmat  27
+#define SYS_shmdt  28
+#define SYS_meminfo 29
+#define SYS_sbrkhuge 30
+#define SYS_bcstat 31
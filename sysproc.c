@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "meminfo.h"
+#include "bcstat.h"
 
 int
 sys_fork(void)
@@ -56,6 +58,18 @@ sys_sbrk(void)
   return addr;
 }
 
+// Like sbrk, but with 4 MB pages; the new memory starts at
+// the next 4 MB boundary, which is what is returned.
+int
+sys_sbrkhuge(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return growhuge(n);
+}
+
 int
 sys_sleep(void)
 {
@@ -71,7 +85,9 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
+    myproc()->swapok = 1;
     sleep(&ticks, &tickslock);
+    myproc()->swapok = 0;
   }
   release(&tickslock);
   return 0;
@@ -124,3 +140,67 @@ int sys_ps(void){
   return 0;
 }
 
+
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
+int
+sys_meminfo(void)
+{
+  struct meminfo *mi;
+  char *p;
+  int r;
+
+  if(argptr(0, &p, sizeof(*mi)) < 0)
+    return -1;
+  // Gather into a kernel page; procmemstat holds ptable.lock,
+  // so it must not touch user memory.
+  if((mi = (struct meminfo*)kalloc()) == 0)
+    return -1;
+  kmemstat(mi);
+  swapstat(mi);
+  procmemstat(mi);
+  r = copyout(myproc()->pgdir, (uint)p, mi, sizeof(*mi));
+  kfree((char*)mi);
+  return r;
+}
+
+int
+sys_bcstat(void)
+{
+  struct bcstat st;
+  char *p;
+
+  if(argptr(0, &p, sizeof(st)) < 0)
+    return -1;
+  bstat(&st);
+  idestat(&st);
+  return copyout(myproc()->pgdir, (uint)p, &st, sizeof(st));
+}
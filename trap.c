@@ -77,9 +77,34 @@ trap(struct trapframe *tf)
             cpuid(), tf->cs, tf->eip);
     lapiceoi();
     break;
+  case T_PGFLT:
+    // Bring in a swapped-out page.  The kernel makes sure the
+    // user memory it uses is resident (see fetchint), so only
+    // user code faults on swapped-out pages.
+    // Grow the stack on a fault just below it or the stack
+    // pointer; a fault further down, e.g. in the guard page,
+    // kills the process.
+    if(myproc() == 0 || (tf->cs&3) != DPL_USER)
+      goto bad;
+    if(swapinuvm(myproc()->pgdir, rcr2(), 1) > 0){
+      myproc()->majflt++;
+      break;
+    }
+    if(growstack(myproc()->pgdir, &myproc()->stack, rcr2(), tf->esp) == 0){
+      myproc()->minflt++;
+      break;
+    }
+    goto bad;
 
   //PAGEBREAK: 13
   default:
+    // The virtio disk's IRQ is assigned by the BIOS.
+    if(virtioirq && tf->trapno == T_IRQ0 + virtioirq){
+      virtiointr();
+      lapiceoi();
+      break;
+    }
+  bad:
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -102,9 +127,14 @@ trap(struct trapframe *tf)
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
+  // A process preempted in user space is a good time to
+  // swap its pages out: the kernel isn't using them.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER){
+    myproc()->swapok = (tf->cs&3) == DPL_USER;
     yield();
+    myproc()->swapok = 0;
+  }
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct meminfo;
+struct bcstat;
 
 // system calls
 int fork(void);
@@ -27,6 +29,12 @@ int getpname(int);
 int getnice(int);
 int setnice(int, int);
 void ps(int);
+int shmget(int, int);
+char* shmat(int);
+int shmdt(void*);
+int meminfo(struct meminfo*);
+char* sbrkhuge(int);
+int bcstat(struct bcstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "mmu.h"
+#include "meminfo.h"
 
 char buf[8192];
 char name[3];
@@ -457,6 +459,93 @@ mem(void)
   }
 }
 
+// A child fills nearly all free memory, then the parent
+// allocates more than is left, so that the child's pages
+// must go out to swap.  The child then checks that each page
+// comes back intact when it faults on it.
+void
+swaptest(void)
+{
+  static struct meminfo mi;
+  int toparent[2], tochild[2], pid, i, n, extra;
+  uint swapout;
+  char *p, c;
+
+  printf(stdout, "swap test\n");
+  if(meminfo(&mi) < 0){
+    printf(stdout, "swap test: meminfo failed\n");
+    exit();
+  }
+  if(mi.nswap - mi.swapused < 64){
+    printf(stdout, "swap test: no swap space\n");
+    exit();
+  }
+  n = mi.nfree - 256;
+  extra = 256 + (mi.nswap - mi.swapused) / 2;
+  if(pipe(toparent) != 0 || pipe(tochild) != 0){
+    printf(stdout, "swap test: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "swap test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(toparent[0]);
+    close(tochild[1]);
+    if((p = sbrk(n*PGSIZE)) == (char*)-1){
+      printf(stdout, "swap test: sbrk failed\n");
+      exit();
+    }
+    for(i = 0; i < n; i++){
+      p[i*PGSIZE] = i;
+      p[i*PGSIZE + PGSIZE-1] = i >> 8;
+    }
+    write(toparent[1], "x", 1);
+    read(tochild[0], &c, 1);  // asleep, so its pages may go
+    c = 'y';
+    for(i = 0; i < n; i++){
+      if(p[i*PGSIZE] != (char)i || p[i*PGSIZE + PGSIZE-1] != (char)(i >> 8)){
+        printf(stdout, "swap test: page %d is wrong\n", i);
+        c = 'n';
+        break;
+      }
+    }
+    write(toparent[1], &c, 1);
+    exit();
+  }
+
+  close(toparent[1]);
+  close(tochild[0]);
+  if(read(toparent[0], &c, 1) != 1){
+    printf(stdout, "swap test: child failed\n");
+    exit();
+  }
+  meminfo(&mi);
+  swapout = mi.swapout;
+  if(sbrk(extra*PGSIZE) == (char*)-1){
+    printf(stdout, "swap test: parent sbrk failed\n");
+    exit();
+  }
+  meminfo(&mi);
+  sbrk(-extra*PGSIZE);
+  if(mi.swapout == swapout){
+    printf(stdout, "swap test: nothing was swapped out\n");
+    exit();
+  }
+  write(tochild[1], "x", 1);
+  if(read(toparent[0], &c, 1) != 1 || c != 'y'){
+    printf(stdout, "swap test failed\n");
+    exit();
+  }
+  wait();
+  close(toparent[0]);
+  close(tochild[1]);
+  printf(stdout, "swap test OK\n");
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1347,8 +1436,12 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
-  for(i = 0; i < 50 + 1; i++){
+  // The inode cache has no fixed size, so a leaked reference
+  // no longer runs it out.  Instead each pass removes its
+  // directory again: if _namei() leaked a reference to it, the
+  // inode would stay allocated on disk, and ialloc() would run
+  // out after the 200 inodes mkfs makes (NINODES).
+  for(i = 0; i < 200 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
       exit();
@@ -1367,6 +1460,11 @@ iref(void)
     if(fd >= 0)
       close(fd);
     unlink("xx");
+
+    if(chdir("..") != 0 || unlink("irefd") != 0){
+      printf(1, "unlink irefd failed\n");
+      exit();
+    }
   }
 
   chdir("/");
@@ -1606,6 +1704,75 @@ bsstest(void)
   printf(stdout, "bss test ok\n");
 }
 
+// Recurse depth levels deep with a KB of locals per frame.
+int
+stackrecurse(int depth)
+{
+  volatile char frame[1024];
+  int i, sum;
+
+  for(i = 0; i < sizeof(frame); i++)
+    frame[i] = depth;
+  sum = depth > 0 ? stackrecurse(depth - 1) : 0;
+  for(i = 0; i < sizeof(frame); i++)
+    if(frame[i] != (char)depth)
+      return -1;
+  return sum < 0 ? sum : sum + 1;
+}
+
+// does the stack grow past its first page, up to MAXSTACK?
+// is a touch below it, in the guard page, past MAXSTACK or
+// far below the stack pointer, fatal?
+void
+stacktest(void)
+{
+  volatile char big[64*1024];
+  int i, pid, ppid;
+
+  printf(stdout, "stack test\n");
+  for(i = 0; i < sizeof(big); i += PGSIZE)
+    big[i] = i / PGSIZE;
+  for(i = 0; i < sizeof(big); i += PGSIZE){
+    if(big[i] != (char)(i / PGSIZE)){
+      printf(stdout, "stack test: big array corrupted\n");
+      exit();
+    }
+  }
+  if(stackrecurse(256) != 256){
+    printf(stdout, "stack test: deep recursion failed\n");
+    exit();
+  }
+
+  ppid = getpid();
+  pid = fork();
+  if(pid == 0){
+    *(volatile char*)(STACKBASE - 1) = 1;
+    printf(stdout, "stack test: could write the guard page\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+
+  pid = fork();
+  if(pid == 0){
+    *(volatile char*)(STACKBASE + PGSIZE) = 1;
+    printf(stdout, "stack test: stray write grew the stack\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+
+  pid = fork();
+  if(pid == 0){
+    stackrecurse(2*MAXSTACK/1024);
+    printf(stdout, "stack test: could recurse past MAXSTACK\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+  printf(stdout, "stack test ok\n");
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -1767,6 +1934,7 @@ main(int argc, char *argv[])
   bigwrite();
   bigargtest();
   bsstest();
+  stacktest();
   sbrktest();
   validatetest();
 
@@ -1780,6 +1948,7 @@ main(int argc, char *argv[])
   iputtest();
 
   mem();
+  swaptest();
   pipe1();
   preempt();
   exitwait();
@@ -0,0 +1,317 @@
+// Virtio block device driver, for the legacy (virtio 0.9.5)
+// PCI interface that QEMU's virtio-blk-pci provides.
+//
+// When ideinit() finds such a device it serves disk 1 (the
+// file system and swap) in place of the IDE disk.  Each buf
+// becomes one request of three descriptors: a header naming
+// the operation and sector, the buf's data, and a status
+// byte.  There is no seek to order requests for, so they are
+// all handed to the device at once, up to the size of the
+// queue; the rest wait in vdisk.pending for descriptors.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+
+#define VIRTIO_BLK_ID     0x10011AF4  // legacy virtio-blk
+
+// Legacy virtio PCI registers, in I/O space at BAR 0.
+#define VIO_DEVFEATURES   0x00
+#define VIO_DRVFEATURES   0x04
+#define VIO_QUEUEPFN      0x08
+#define VIO_QUEUESIZE     0x0C
+#define VIO_QUEUESEL      0x0E
+#define VIO_QUEUENOTIFY   0x10
+#define VIO_STATUS        0x12
+#define VIO_ISR           0x13
+#define VIO_BLKCAPACITY   0x14  // in 512-byte sectors, 64 bits
+
+// Device status bits.
+#define VIO_ACK           1
+#define VIO_DRIVER        2
+#define VIO_DRIVER_OK     4
+
+// Descriptor flags.
+#define VRING_NEXT        1
+#define VRING_WRITE       2     // device writes the buffer
+
+#define VIRTIO_BLK_T_IN   0     // read
+#define VIRTIO_BLK_T_OUT  1     // write
+
+#define VQMAX             256   // largest queue we can lay out
+#define VQORDER           2     // pages for a VQMAX-entry queue
+
+struct vdesc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vusedelem {
+  uint id;      // head descriptor of the finished request
+  uint len;
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;
+  struct vusedelem ring[];
+};
+
+struct blkhdr {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+
+static struct {
+  struct spinlock lock;
+  uint base;              // I/O port base
+  uint nsector;           // capacity
+  int n;                  // queue size
+  struct vdesc *desc;
+  struct vavail *avail;
+  volatile struct vused *used;
+  ushort usedidx;         // next used entry to look at
+  int nfree;
+  uchar free[VQMAX];      // descriptor free?
+  struct {                // by head descriptor
+    struct buf *b;
+    struct blkhdr hdr;
+    uchar status;
+  } req[VQMAX];
+  struct buf *pending;    // waiting for descriptors
+  int nreq;               // requests started or pending
+} vdisk;
+
+int virtioirq;            // 0 if there is no virtio disk
+
+// Find and set up a virtio block device.
+// Returns 0 on success, -1 if there is none.
+int
+virtioinit(void)
+{
+  struct pcidev d;
+  char *q;
+  int i;
+
+  if(pcifind(VIRTIO_BLK_ID, 0, &d) < 0 || !(d.bar[0] & 1))
+    return -1;
+  pcienable(&d);
+  initlock(&vdisk.lock, "virtio");
+  vdisk.base = d.bar[0] & ~3;
+
+  outb(vdisk.base + VIO_STATUS, 0);  // reset
+  outb(vdisk.base + VIO_STATUS, VIO_ACK);
+  outb(vdisk.base + VIO_STATUS, VIO_ACK | VIO_DRIVER);
+  outl(vdisk.base + VIO_DRVFEATURES, 0);  // no optional features
+
+  outw(vdisk.base + VIO_QUEUESEL, 0);
+  vdisk.n = inw(vdisk.base + VIO_QUEUESIZE);
+  if(vdisk.n == 0 || vdisk.n > VQMAX)
+    panic("virtioinit: queue size");
+  if((q = kallocpages(VQORDER)) == 0)
+    panic("virtioinit: no memory");
+  memset(q, 0, PGSIZE << VQORDER);
+
+  // Legacy layout: descriptors and available ring, then the
+  // used ring on the next page boundary.
+  vdisk.desc = (struct vdesc*)q;
+  vdisk.avail = (struct vavail*)(q + vdisk.n*sizeof(struct vdesc));
+  vdisk.used = (struct vused*)PGROUNDUP((uint)&vdisk.avail->ring[vdisk.n+1]);
+  outl(vdisk.base + VIO_QUEUEPFN, V2P(q) / PGSIZE);
+
+  for(i = 0; i < vdisk.n; i++)
+    vdisk.free[i] = 1;
+  vdisk.nfree = vdisk.n;
+  vdisk.nsector = inl(vdisk.base + VIO_BLKCAPACITY);
+  if(inl(vdisk.base + VIO_BLKCAPACITY + 4) != 0)
+    vdisk.nsector = ~0;
+
+  outb(vdisk.base + VIO_STATUS, VIO_ACK | VIO_DRIVER | VIO_DRIVER_OK);
+  virtioirq = d.irq;
+  ioapicenable(virtioirq, ncpu - 1);
+  return 0;
+}
+
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vdisk.n; i++){
+    if(vdisk.free[i]){
+      vdisk.free[i] = 0;
+      vdisk.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: no free desc");
+}
+
+// Free the chain of descriptors starting at i.
+static void
+freechain(int i)
+{
+  int flags;
+
+  for(;;){
+    flags = vdisk.desc[i].flags;
+    vdisk.free[i] = 1;
+    vdisk.nfree++;
+    if(!(flags & VRING_NEXT))
+      break;
+    i = vdisk.desc[i].next;
+  }
+}
+
+static void
+setdesc(int i, void *p, uint len, int flags, int next)
+{
+  vdisk.desc[i].addr = V2P(p);
+  vdisk.desc[i].addrhi = 0;
+  vdisk.desc[i].len = len;
+  vdisk.desc[i].flags = flags;
+  vdisk.desc[i].next = next;
+}
+
+// Hand the request for b to the device.
+// Caller must hold vdisk.lock, and there must be three
+// free descriptors.
+static void
+vstart(struct buf *b)
+{
+  int d0, d1, d2, write;
+
+  write = b->flags & B_DIRTY;
+  d0 = allocdesc();
+  d1 = allocdesc();
+  d2 = allocdesc();
+
+  vdisk.req[d0].b = b;
+  vdisk.req[d0].hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vdisk.req[d0].hdr.reserved = 0;
+  vdisk.req[d0].hdr.sector = b->blockno * (BSIZE/512);
+  vdisk.req[d0].hdr.sectorhi = 0;
+  vdisk.req[d0].status = 0xff;
+
+  setdesc(d0, &vdisk.req[d0].hdr, sizeof(struct blkhdr), VRING_NEXT, d1);
+  setdesc(d1, b->data, BSIZE, VRING_NEXT | (write ? 0 : VRING_WRITE), d2);
+  setdesc(d2, &vdisk.req[d0].status, 1, VRING_WRITE, 0);
+
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.n] = d0;
+  __sync_synchronize();  // ring entry before index
+  vdisk.avail->idx++;
+  __sync_synchronize();  // index before notify
+  outw(vdisk.base + VIO_QUEUENOTIFY, 0);
+}
+
+// Queue b for the device and return without waiting.
+// Returns the number of requests now queued.
+int
+virtiosubmit(struct buf *b)
+{
+  struct buf **pp;
+  int n;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiosubmit: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiosubmit: nothing to do");
+  if((b->blockno + 1) * (BSIZE/512) > vdisk.nsector)
+    panic("virtiosubmit: block out of range");
+
+  acquire(&vdisk.lock);
+  if(vdisk.pending == 0 && vdisk.nfree >= 3)
+    vstart(b);
+  else {
+    b->qnext = 0;
+    for(pp = &vdisk.pending; *pp; pp = &(*pp)->qnext)
+      ;
+    *pp = b;
+  }
+  n = ++vdisk.nreq;
+  release(&vdisk.lock);
+  return n;
+}
+
+// Wait for the request for b to finish.
+void
+virtiowaitbuf(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    sleep(b, &vdisk.lock);
+  }
+  release(&vdisk.lock);
+}
+
+// Interrupt handler.
+void
+virtiointr(void)
+{
+  struct buf *b, *doneq;
+  void (*done)(struct buf*);
+  int id;
+
+  // Reading the ISR acknowledges the interrupt.
+  inb(vdisk.base + VIO_ISR);
+
+  acquire(&vdisk.lock);
+  doneq = 0;
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();  // index before ring entry
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.n].id;
+    vdisk.usedidx++;
+    b = vdisk.req[id].b;
+    if(vdisk.req[id].status != 0)
+      panic("virtio: request failed");
+    vdisk.req[id].b = 0;
+    vdisk.nreq--;
+    freechain(id);
+
+    // A buf with a completion belongs to it, so no one else
+    // looks at the buf or its qnext once it is valid.
+    if(b->iodone){
+      b->qnext = doneq;
+      doneq = b;
+    }
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+  }
+
+  // Start waiting requests in the freed descriptors.
+  while((b = vdisk.pending) != 0 && vdisk.nfree >= 3){
+    vdisk.pending = b->qnext;
+    vstart(b);
+  }
+  release(&vdisk.lock);
+
+  // Run the completions without the lock, as ideintr does.
+  while((b = doneq) != 0){
+    doneq = b->qnext;
+    done = b->iodone;
+    b->iodone = 0;
+    done(b);
+  }
+}
@@ -10,6 +10,11 @@
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+#define PDORDER (PDXSHIFT - PTXSHIFT)  // a 4 MB page is 2^PDORDER pages
+#if PDORDER > MAXORDER
+#error "kallocpages() cannot allocate a 4 MB page; raise MAXORDER"
+#endif
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -31,7 +36,8 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages.  Returns 0 for
+// addresses mapped by a 4 MB page, which have no PTE.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +45,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // A zeroed page has all those PTE_P bits clear.
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -83,7 +90,8 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
 // page protection bits prevent user code from using the kernel's
-// mappings.
+// mappings.  The kernel half of every page directory is a copy of
+// kpgdir's, so all page tables share the kernel's page table pages.
 //
 // setupkvm() and exec() set up every page table like this:
 //
@@ -92,13 +100,19 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// at boot by kinit1() and at most MAXPHYS)
+// (directly addressable from end..P2V(phystop)).
+//
+// Kernel mappings use 4 MB pages (PTE_PS) where they can, so the
+// whole direct map above the first 4 MB costs no page table pages
+// and few TLB entries.  The first 4 MB, which hold the kernel's
+// text and data, keep 4 KB pages so the text stays read-only.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -110,37 +124,67 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Map the kernel region k in pgdir, with 4 MB pages wherever
+// both addresses are 4 MB aligned and 4 KB pages elsewhere.
+// The mappings are global (PTE_G), so their TLB entries
+// survive the lcr3() in switchuvm() and switchkvm().
+static int
+kmapregion(pde_t *pgdir, struct kmap *k)
+{
+  uint va, pa, size, n;
+
+  va = (uint)k->virt;
+  pa = k->phys_start;
+  size = k->phys_end - k->phys_start;
+  while(size > 0){
+    if(va % PDSIZE == 0 && pa % PDSIZE == 0 && size >= PDSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | k->perm | PTE_P | PTE_PS | PTE_G;
+      n = PDSIZE;
+    } else {
+      if(mappages(pgdir, (void*)va, PGSIZE, pa, k->perm | PTE_G) < 0)
+        return -1;
+      n = PGSIZE;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE))*sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel mappings are built
+// once, here, and copied into every other page table by setupkvm().
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  kmap[2].phys_end = phystop;  // known only at boot
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(kmapregion(kpgdir, k) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -186,8 +230,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -210,12 +253,50 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
       n = sz - i;
     else
       n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
+    if(readi(ip, 0, P2V(pa), offset+i, n) != n)
       return -1;
   }
   return 0;
 }
 
+// Map the read-only program segment of ip at file offset
+// offset into pgdir at addr, sharing its pages with other
+// processes through pcache.c; memory beyond the first
+// filesz bytes is private and zeroed.  addr and offset must
+// be page-aligned and addr no lower than sz, the current
+// size of the process; any gap is filled with private memory.
+// Returns new size addr+memsz or 0 on error.
+int
+mapfileuvm(pde_t *pgdir, uint sz, char *addr, struct inode *ip,
+           uint offset, uint filesz, uint memsz)
+{
+  uint i, n;
+  char *mem;
+
+  if((uint)addr % PGSIZE != 0 || offset % PGSIZE != 0)
+    panic("mapfileuvm: not page aligned");
+  if((uint)addr > sz && (sz = allocuvm(pgdir, sz, (uint)addr)) == 0)
+    return 0;
+  for(i = 0; i < memsz; i += PGSIZE){
+    if(i < filesz){
+      n = filesz - i < PGSIZE ? filesz - i : PGSIZE;
+      mem = pcacheget(ip, offset + i, n);
+    } else
+      mem = swapalloc();
+    if(mem == 0)
+      goto bad;
+    if(mappages(pgdir, addr + i, PGSIZE, V2P(mem), PTE_U) < 0){
+      kfree(mem);
+      goto bad;
+    }
+  }
+  return (uint)addr + memsz;
+
+bad:
+  deallocuvm(pgdir, (uint)addr + i, sz);
+  return 0;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -224,20 +305,24 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > USERTOP)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(pgdir[PDX(a)] & PTE_PS){
+      // Still backed by a 4 MB page (see deallocuvm).
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    mem = swapalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,10 +333,43 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Map 4 MB pages (PTE_PS) to grow process from oldsz, which
+// must be 4 MB aligned, to newsz.  Each is a physically
+// contiguous block from kallocpages(), so it needs no page
+// table and one TLB entry; these pages are never swapped
+// out.  Returns the new size, rounded up to 4 MB, or 0 on
+// error.
+int
+allochugeuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  char *mem;
+  uint a;
+
+  if(oldsz % PDSIZE)
+    panic("allochugeuvm");
+  if(newsz > USERTOP || PDROUNDUP(newsz) > USERTOP)
+    return 0;
+  for(a = oldsz; a < newsz; a += PDSIZE){
+    if(pgdir[PDX(a)] & PTE_P){
+      // An empty page table left by an earlier sbrk shrink.
+      kfree(P2V(PTE_ADDR(pgdir[PDX(a)])));
+      pgdir[PDX(a)] = 0;
+    }
+    if((mem = swapallocpages(PDORDER)) == 0){
+      deallocuvm(pgdir, a, oldsz);
+      return 0;
+    }
+    memset(mem, 0, PDSIZE);
+    pgdir[PDX(a)] = V2P(mem) | PTE_PS | PTE_P | PTE_W | PTE_U;
+  }
+  return a;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  A 4 MB page is freed only if all of it is above
+// newsz.  Returns the new process size.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -263,6 +381,14 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      if(a % PDSIZE == 0){
+        kfreepages(P2V(PTE_ADDR(pgdir[PDX(a)])), PDORDER);
+        pgdir[PDX(a)] = 0;
+      }
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -273,11 +399,121 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_ADDR(*pte) >> PTXSHIFT);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
+// Bring the swapped-out user pages of pgdir in [va, va+n)
+// back into memory.  May sleep.  Returns the number of pages
+// read in, or -1 if there was no memory for them.
+int
+swapinuvm(pde_t *pgdir, uint va, uint n)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+  int nin;
+
+  nin = 0;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_SWAP) == 0)
+      continue;
+    if((mem = swapalloc()) == 0)
+      return -1;
+    swapread(PTE_ADDR(*pte) >> PTXSHIFT, mem);
+    swapfree(PTE_ADDR(*pte) >> PTXSHIFT);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_P;
+    nin++;
+  }
+  return nin;
+}
+
+// Count the resident and the swapped-out pages in the
+// user part of pgdir.
+void
+countuvm(pde_t *pgdir, uint *rss, uint *nswap)
+{
+  pte_t *pgtab;
+  uint i, j;
+
+  *rss = *nswap = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    if(pgdir[i] & PTE_PS){
+      *rss += NPTENTRIES;
+      continue;
+    }
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_P)
+        (*rss)++;
+      else if(pgtab[j] & PTE_SWAP)
+        (*nswap)++;
+    }
+  }
+}
+
+// One step of the clock page replacement algorithm over the
+// user pages of pgdir below sz, starting at *hand: pages used
+// since the last pass (PTE_A) get a second chance, and pages
+// shared with other page tables are skipped.  The PTE of the
+// chosen page is replaced by npte.  Returns the page, or 0
+// if the hand reached sz without choosing one.
+// pgdir must not be in use on any CPU.
+char*
+evictuvm(pde_t *pgdir, uint sz, uint *hand, uint npte)
+{
+  pte_t *pte;
+  char *v;
+
+  for(; *hand < sz; *hand += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)*hand, 0);
+    if(!pte){
+      *hand = PGADDR(PDX(*hand) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    v = P2V(PTE_ADDR(*pte));
+    if(krefcnt(v) > 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    *pte = npte | (PTE_FLAGS(*pte) & ~(PTE_P|PTE_A|PTE_D));
+    *hand += PGSIZE;
+    return v;
+  }
+  return 0;
+}
+
+// Map the n pages in pages[] at user address va in pgdir,
+// taking a new reference to each one, so that several page
+// tables can share the same physical memory (see shm.c).
+// Returns 0 on success, -1 with nothing mapped on error.
+int
+shareuvm(pde_t *pgdir, uint va, char **pages, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE,
+                V2P(pages[i]), PTE_W|PTE_U) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+    kdup(pages[i]);
+  }
+  return 0;
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -288,7 +524,8 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  // The kernel's page tables are shared; leave them alone.
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -297,94 +534,202 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
-// Clear PTE_U on a page. Used to create an inaccessible
-// page beneath the user stack.
-void
-clearpteu(pde_t *pgdir, char *uva)
+// Grow the user stack, whose lowest page is at *stack,
+// down to cover va, which must lie within the stack region
+// (STACKBASE..STACKTOP) and no more than STACKGAP below
+// either the stack or the user's stack pointer esp; an
+// access further down is a stray pointer, not stack use.
+// Updates *stack.  May sleep.  Returns 0 on success, -1 if
+// va is not such an address or if memory runs out.
+int
+growstack(pde_t *pgdir, uint *stack, uint va, uint esp)
 {
-  pte_t *pte;
+  char *mem;
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if(pte == 0)
-    panic("clearpteu");
-  *pte &= ~PTE_U;
+  if(va < STACKBASE || va >= *stack)
+    return -1;
+  if(va + STACKGAP < *stack && va + STACKGAP < esp)
+    return -1;
+  while(*stack > PGROUNDDOWN(va)){
+    if((mem = swapalloc()) == 0)
+      return -1;
+    if(mappages(pgdir, (char*)*stack - PGSIZE, PGSIZE, V2P(mem),
+                PTE_W|PTE_U) < 0){
+      kfree(mem);
+      return -1;
+    }
+    *stack -= PGSIZE;
+  }
+  return 0;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+// Copy the user pages of pgdir in [start, end) to d.
+static int
+copyrange(pde_t *d, pde_t *pgdir, uint start, uint end)
 {
-  pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
   char *mem;
 
-  if((d = setupkvm()) == 0)
-    return 0;
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = start; i < end; i += PGSIZE){
+    if(pgdir[PDX(i)] & PTE_PS){
+      if((mem = swapallocpages(PDORDER)) == 0)
+        return -1;
+      memmove(mem, P2V(PTE_ADDR(pgdir[PDX(i)])), PDSIZE);
+      d[PDX(i)] = V2P(mem) | PTE_FLAGS(pgdir[PDX(i)]);
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
+    if(!(*pte & (PTE_P|PTE_SWAP)))
       panic("copyuvm: page not present");
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
+    if(!(flags & (PTE_W|PTE_SWAP))){
+      // Read-only pages never change, so share them.
+      mem = kdup(P2V(pa));
+    } else if((mem = swapalloc()) == 0)
+      return -1;
+    else if(*pte & PTE_SWAP){
+      // Give the child a resident copy; leave the parent's swapped.
+      swapread(pa >> PTXSHIFT, mem);
+      flags = (flags & ~PTE_SWAP) | PTE_P;
+    } else
+      memmove(mem, (char*)P2V(pa), PGSIZE);
     if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
       kfree(mem);
-      goto bad;
+      return -1;
     }
   }
-  return d;
-
-bad:
-  freevm(d);
   return 0;
 }
 
-//PAGEBREAK!
-// Map user virtual address to kernel address.
-char*
-uva2ka(pde_t *pgdir, char *uva)
+// Given a parent process's page table, create a copy
+// of it for a child: memory below sz and the stack
+// from stack up to STACKTOP.
+pde_t*
+copyuvm(pde_t *pgdir, uint sz, uint stack)
 {
-  pte_t *pte;
+  pde_t *d;
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if((d = setupkvm()) == 0)
     return 0;
-  if((*pte & PTE_U) == 0)
+  if(copyrange(d, pgdir, 0, sz) < 0 ||
+     copyrange(d, pgdir, stack, STACKTOP) < 0){
+    freevm(d);
     return 0;
-  return (char*)P2V(PTE_ADDR(*pte));
+  }
+  return d;
 }
 
-// Copy len bytes from p to user address va in page table pgdir.
-// Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+//PAGEBREAK!
+// Copy n bytes from src to dst, which must not overlap,
+// a word at a time.
+static void
+movmem(char *dst, char *src, uint n)
+{
+  movsl(dst, src, n/4);
+  movsb(dst + (n & ~3), src + (n & ~3), n & 3);
+}
+
+// Can the user write all of va..va+len-1?  The kernel runs
+// with CR0.WP set, so it must not store into read-only user
+// pages, such as shared program text, either.
 int
-copyout(pde_t *pgdir, uint va, void *p, uint len)
+uwritable(pde_t *pgdir, uint va, uint len)
 {
-  char *buf, *pa0;
-  uint n, va0;
+  pde_t pde;
+  pte_t *pte;
+  uint a, last;
 
-  buf = (char*)p;
+  if(len == 0)
+    return 1;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(;;){
+    pde = pgdir[PDX(a)];
+    if(pde & PTE_PS){
+      if((pde & (PTE_P|PTE_W|PTE_U)) != (PTE_P|PTE_W|PTE_U))
+        return 0;
+    } else if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0 ||
+              (*pte & (PTE_P|PTE_W|PTE_U)) != (PTE_P|PTE_W|PTE_U))
+      return 0;
+    if(a == last)
+      return 1;
+    a += PGSIZE;
+  }
+}
+
+// Copy len bytes between kernel buffer p and user address va
+// in page table pgdir: to user memory if out, else from it.
+// Looks up each page table page once, rather than walking
+// from the top for every page.  Only PTE_U pages can be
+// used, and only writable ones if out.  Never sleeps, so it
+// can be used with spinlocks held; the memory must already
+// be resident (see argptr).
+static int
+copyuser(pde_t *pgdir, uint va, char *p, uint len, int out)
+{
+  pte_t *pgtab, need;
+  char *k;
+  uint n;
+
+  need = PTE_P | PTE_U | (out ? PTE_W : 0);
   while(len > 0){
-    va0 = (uint)PGROUNDDOWN(va);
-    pa0 = uva2ka(pgdir, (char*)va0);
-    if(pa0 == 0)
+    if(pgdir[PDX(va)] & PTE_PS){
+      // A 4 MB page: one contiguous piece.
+      if((pgdir[PDX(va)] & need) != need)
+        return -1;
+      k = (char*)P2V(PTE_ADDR(pgdir[PDX(va)])) + va % PDSIZE;
+      n = PDSIZE - va % PDSIZE;
+      if(n > len)
+        n = len;
+      if(out)
+        movmem(k, p, n);
+      else
+        movmem(p, k, n);
+      len -= n;
+      p += n;
+      va += n;
+      continue;
+    }
+    if(!(pgdir[PDX(va)] & PTE_P))
       return -1;
-    n = PGSIZE - (va - va0);
-    if(n > len)
-      n = len;
-    memmove(pa0 + (va - va0), buf, n);
-    len -= n;
-    buf += n;
-    va = va0 + PGSIZE;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[PDX(va)]));
+    do {
+      if((pgtab[PTX(va)] & need) != need)
+        return -1;
+      k = (char*)P2V(PTE_ADDR(pgtab[PTX(va)])) + va % PGSIZE;
+      n = PGSIZE - va % PGSIZE;
+      if(n > len)
+        n = len;
+      if(out)
+        movmem(k, p, n);
+      else
+        movmem(p, k, n);
+      len -= n;
+      p += n;
+      va += n;
+    } while(len > 0 && PTX(va) != 0);
   }
   return 0;
 }
 
+// Copy len bytes from p to user address va in page table pgdir.
+int
+copyout(pde_t *pgdir, uint va, void *p, uint len)
+{
+  return copyuser(pgdir, va, (char*)p, len, 1);
+}
+
+// Copy len bytes from user address va in page table pgdir to p.
+int
+copyin(pde_t *pgdir, void *p, uint va, uint len)
+{
+  return copyuser(pgdir, va, (char*)p, len, 0);
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!